@@ -126,7 +126,7 @@ signal scanline_pixel : std_logic := '0';
 
 signal bit_position : unsigned(3 downto 0) := (others => '0');
 
-signal led_on_time : unsigned(7 downto 0) := X"10";
+signal led_on_time : unsigned(7 downto 0) := X"10"; -- Brightness: on-time of the least significant bit plane, in clocks
 signal led_on_counter : unsigned(17 downto 0) := (others => '0');
 signal start_oe : std_logic := '0';
 signal oe_working : std_logic := '0';
@@ -138,6 +138,31 @@ signal waitcount : unsigned(3 downto 0);
 signal led_state : led_state_type := startoutput;
 signal display_completed : std_logic := '0';
 
+-- Display page: the scan reads from a 2048 word page of the framebuffer, selected in units of one panel.
+-- A new page is requested over SPI and only takes effect at the end of a frame, so the display never tears.
+signal display_page : unsigned(2 downto 0) := (others => '0');
+signal display_page_next : unsigned(2 downto 0) := (others => '0');
+signal flip_request : std_logic := '0';
+signal flip_done : std_logic := '0';
+signal display_status : std_logic_vector(7 downto 0) := (others => '0');
+
+-- Scroll origin: the panel shows a window into a virtual canvas of (scroll_last+1) panel regions side by side, starting at
+-- column scroll_x and wrapping around at the right edge. Like the page, it changes only at the end of a frame.
+signal scroll_x : unsigned(7 downto 0) := (others => '0');
+signal scroll_x_next : unsigned(7 downto 0) := (others => '0');
+signal scroll_last : unsigned(2 downto 0) := (others => '0');
+signal scroll_last_next : unsigned(2 downto 0) := (others => '0');
+signal scan_x : unsigned(7 downto 0); -- Canvas column being read
+signal scan_count : unsigned(4 downto 0); -- Pixels read on this scanline
+
+-- Display control. Fewer bit planes drop the least significant ones, trading color depth for refresh rate.
+-- Plane and row counts change at the end of a frame, brightness and blanking right away.
+signal plane_first : unsigned(2 downto 0) := (others => '0'); -- First bit plane shown
+signal plane_first_next : unsigned(2 downto 0) := (others => '0');
+signal scan_last : unsigned(3 downto 0) := X"F"; -- Last scanline (rows driven per panel half, minus one)
+signal scan_last_next : unsigned(3 downto 0) := X"F";
+signal display_blank : std_logic := '0';
+
 
 signal frameread_addr : unsigned(13 downto 0);
 signal frameread_data : std_logic_vector(31 downto 0);
@@ -154,7 +179,18 @@ signal scanline_state : unsigned(2 downto 0);
 signal dummy_timer : unsigned(19 downto 0);
 
 
-type spi_mode_type is (command, writeaddress, writedata);
+-- SPI commands (first byte after select):
+--   0x00 Write pixels: 16bit big endian address, then 24bit pixels until deselected.
+--   0x01 Write registers: 8bit register, 16bit big endian value, repeated until deselected.
+--   0x02 Read status: the next byte out is display_status.
+--   0x03 Read pixels: 16bit big endian address, one dummy byte (while the first pixel is fetched), then 24bit pixels
+--        are sent out until deselected.
+-- All other command bytes are treated as 0x00.
+-- Registers:
+--   0x00 Display page (panel regions)      0x01 Scroll column      0x02 Scroll canvas width (panel regions) - 1
+--   0x03 Brightness (LSB plane on-time)    0x04 Bit planes (1-8)   0x05 Scan rows (1-16)
+--   0x06 Blank (bit 0)
+type spi_mode_type is (command, writeaddress, writedata, writeregister, readstatus, readaddress, readdummy, readdata);
 signal spibits : std_logic_vector(31 downto 0);
 signal spibit : unsigned(4 downto 0);
 signal spimode : spi_mode_type;
@@ -162,14 +198,21 @@ signal spioutbyte : std_logic_vector(7 downto 0);
 
 signal spi_write_address : std_logic_vector(15 downto 0);
 signal spi_write_data : std_logic_vector(23 downto 0);
+signal spi_register_data : std_logic_vector(23 downto 0);
+signal spi_read_data : std_logic_vector(23 downto 0); -- Pixel being sent out
+signal read_latch : std_logic_vector(23 downto 0); -- Pixel at frameaccess_addr, for the SPI side to pick up
 
 signal spi_address_toggle : std_logic;
 signal spi_data_toggle : std_logic;
 signal spi_trace_toggle : std_logic;
+signal spi_register_toggle : std_logic;
+signal spi_read_toggle : std_logic;
 
 signal address_toggle_buffer : std_logic_vector(4 downto 0);
 signal data_toggle_buffer : std_logic_vector(4 downto 0);
 signal trace_toggle_buffer : std_logic_vector(4 downto 0);
+signal register_toggle_buffer : std_logic_vector(4 downto 0);
+signal read_toggle_buffer : std_logic_vector(4 downto 0);
 
 
 
@@ -244,6 +287,7 @@ begin
 
 	-- System to pull data from the framebuffer for LED panel, two pixels per 4 cycles
 	process(clk)
+	variable next_x : unsigned(7 downto 0);
 	begin
 		if clk'event and clk = '1' then
 			scanline_pixel <= '0';
@@ -251,7 +295,9 @@ begin
 				if scanline_working = '0' then
 					scanline_working <= '1';
 					-- Prepare to read data
-					frameread_addr <= "00000" & scanline_y & "00000";
+					frameread_addr <= (display_page + scroll_x(7 downto 5)) & "00" & scanline_y & scroll_x(4 downto 0);
+					scan_x <= scroll_x;
+					scan_count <= (others => '0');
 					pixel_delay <= "00";
 				else
 					if scanline_complete = '0' then
@@ -271,10 +317,17 @@ begin
 							scanline_b1 <= "00" & frameread_data(7 downto 0);
 							scanline_pixel <= '1';
 							
-							-- Advance to next pixel.
-							frameread_addr(4 downto 0) <= frameread_addr(4 downto 0) + 1;							
+							-- Advance to next pixel, wrapping at the right edge of the canvas.
+							if scan_x(4 downto 0) = "11111" and scan_x(7 downto 5) = scroll_last then
+								next_x := (others => '0');
+							else
+								next_x := scan_x + 1;
+							end if;
+							scan_x <= next_x;
+							scan_count <= scan_count + 1;
+							frameread_addr <= (display_page + next_x(7 downto 5)) & "00" & scanline_y & next_x(4 downto 0);
 						when "11" =>
-							if frameread_addr(4 downto 0) = "00000" then
+							if scan_count = "00000" then
 								scanline_complete <= '1';
 							end if;
 							
@@ -346,7 +399,7 @@ begin
 	led_b <= scanline_out_y(1);
 	led_a <= scanline_out_y(0);	
 	
-	led_oe <= not oe_working;
+	led_oe <= not (oe_working and not display_blank);
 	
 	process(clk)
 	begin
@@ -429,7 +482,21 @@ begin
 				
 				if bit_position = 7 then
 					scanline_y <= scanline_y + 1;
-					bit_position <= (others => '0');
+					bit_position <= '0' & plane_first;
+					
+					-- End of the frame, switch to the requested page before the next one starts.
+					if scanline_y = scan_last then
+						scanline_y <= (others => '0');
+						plane_first <= plane_first_next;
+						bit_position <= '0' & plane_first_next;
+						scan_last <= scan_last_next;
+						if flip_request /= flip_done then
+							display_page <= display_page_next;
+							flip_done <= flip_request;
+						end if;
+						scroll_x <= scroll_x_next;
+						scroll_last <= scroll_last_next;
+					end if;
 				else
 					bit_position <= bit_position + 1;
 				end if;
@@ -446,6 +513,12 @@ begin
 				scanline_y <= (others => '0');
 				scanline_out_y <= (others => '0');
 				waitcount <= (others => '0');
+				display_page <= (others => '0');
+				flip_done <= flip_request;
+				scroll_x <= (others => '0');
+				scroll_last <= (others => '0');
+				plane_first <= (others => '0');
+				scan_last <= X"F";
 			end if;
 		end if;
 	end process;
@@ -462,6 +535,12 @@ begin
 			address_toggle_buffer <= spi_address_toggle & address_toggle_buffer(4 downto 1);
 			data_toggle_buffer <= spi_data_toggle & data_toggle_buffer(4 downto 1);
 			trace_toggle_buffer <= spi_trace_toggle & trace_toggle_buffer(4 downto 1);
+			register_toggle_buffer <= spi_register_toggle & register_toggle_buffer(4 downto 1);
+			read_toggle_buffer <= spi_read_toggle & read_toggle_buffer(4 downto 1);
+			read_latch <= frameaccess_readdata(23 downto 0);
+			
+			-- Bit 0: a page flip is waiting for the end of the frame.
+			display_status <= "0000000" & (flip_request xor flip_done);
 
 			if trace_toggle_buffer(1) /= trace_toggle_buffer(0) then
 				trace_read_pulse <= '1';
@@ -476,13 +555,51 @@ begin
 				frameaccess_addr <= frameaccess_addr + 1; -- Advance address on the next cycle.
 			end if;
 
+			if read_toggle_buffer(1) /= read_toggle_buffer(0) then
+				frameaccess_addr <= frameaccess_addr + 1; -- SPI side took the pixel, fetch the next one.
+			end if;
+
 			if address_toggle_buffer(1) /= address_toggle_buffer(0) then
 				frameaccess_addr <= unsigned(spi_write_address(13 downto 0));
 			end if;
 
+			if register_toggle_buffer(1) /= register_toggle_buffer(0) then
+				case spi_register_data(23 downto 16) is
+				when X"00" => -- Display page, shown from the next frame
+					display_page_next <= unsigned(spi_register_data(2 downto 0));
+					flip_request <= not flip_request;
+				when X"01" => -- Scroll origin column
+					scroll_x_next <= unsigned(spi_register_data(7 downto 0));
+				when X"02" => -- Scroll canvas width, in panel regions, minus one
+					scroll_last_next <= unsigned(spi_register_data(2 downto 0));
+				when X"03" => -- Brightness
+					led_on_time <= unsigned(spi_register_data(7 downto 0));
+				when X"04" => -- Bit planes (1-8)
+					if unsigned(spi_register_data(3 downto 0)) >= 1 and unsigned(spi_register_data(3 downto 0)) <= 8 then
+						plane_first_next <= resize(8 - unsigned(spi_register_data(3 downto 0)), 3);
+					end if;
+				when X"05" => -- Scan rows (1-16)
+					if unsigned(spi_register_data(4 downto 0)) >= 1 and unsigned(spi_register_data(4 downto 0)) <= 16 then
+						scan_last_next <= resize(unsigned(spi_register_data(4 downto 0)) - 1, 4);
+					end if;
+				when X"06" => -- Blank: bit 0 turns the outputs off
+					display_blank <= spi_register_data(0);
+				when others =>
+				end case;
+			end if;
+
 			if syncreset = '1' then
 				address_toggle_buffer <= (others => '0');
 				data_toggle_buffer <= (others => '0');
+				register_toggle_buffer <= (others => '0');
+				read_toggle_buffer <= (others => '0');
+				display_page_next <= (others => '0');
+				scroll_x_next <= (others => '0');
+				scroll_last_next <= (others => '0');
+				led_on_time <= X"10";
+				plane_first_next <= (others => '0');
+				scan_last_next <= X"F";
+				display_blank <= '0';
 			end if;
 		end if;
 	end process;
@@ -506,9 +623,13 @@ begin
 				when command =>
 					if spibit = 7 then
 						-- Decide what to do based on command in spibits(7 downto 0).
-						-- For now just treat all command bytes as a write data command.
 						spibit <= (others => '0');
-						spimode <= writeaddress;
+						case spibits(7 downto 0) is
+						when X"01" => spimode <= writeregister;
+						when X"02" => spimode <= readstatus;
+						when X"03" => spimode <= readaddress;
+						when others => spimode <= writeaddress;
+						end case;
 					end if;
 					
 				when writeaddress =>
@@ -526,12 +647,57 @@ begin
 						spi_data_toggle <= not spi_data_toggle;
 					end if;
 						
+				when readaddress =>
+					if spibit = 15 then
+						spi_write_address <= spibits(15 downto 0);
+						spibit <= (others => '0');
+						spi_address_toggle <= not spi_address_toggle;
+						spimode <= readdummy;
+					end if;
+
+				when readdummy =>
+					if spibit = 7 then
+						-- The first pixel has been fetched by now.
+						spibit <= (others => '0');
+						spi_read_data <= read_latch;
+						spioutbyte <= read_latch(23 downto 16);
+						spi_read_toggle <= not spi_read_toggle;
+						spimode <= readdata;
+					end if;
+
+				when readdata =>
+					case to_integer(spibit) is
+					when 7 =>
+						spioutbyte <= spi_read_data(15 downto 8);
+					when 15 =>
+						spioutbyte <= spi_read_data(7 downto 0);
+					when 23 =>
+						spibit <= (others => '0');
+						spi_read_data <= read_latch;
+						spioutbyte <= read_latch(23 downto 16);
+						spi_read_toggle <= not spi_read_toggle;
+					when others =>
+					end case;
+
+				when writeregister =>
+					if spibit = 23 then
+						spi_register_data <= spibits(23 downto 0);
+						spibit <= (others => '0');
+						spi_register_toggle <= not spi_register_toggle;
+					end if;
+						
 				when others =>
 			end case;
 			
 			if spibit(2 downto 0) = 7 then
-				spi_trace_toggle <= not spi_trace_toggle;
-				spioutbyte <= trace_read;
+				if spimode = command and spibits(7 downto 0) = X"02" then
+					spioutbyte <= display_status;
+				elsif spimode = readaddress or spimode = readdummy or spimode = readdata or (spimode = command and spibits(7 downto 0) = X"03") then
+					null; -- Pixel data is loaded above, leave the trace alone.
+				else
+					spi_trace_toggle <= not spi_trace_toggle;
+					spioutbyte <= trace_read;
+				end if;
 			end if;
 		
 		end if;
@@ -37,9 +37,68 @@ namespace SignControl
             TestBoard.SetMode(SignTest.DeviceMode.On);
             TestBoard.SetMode(SignTest.DeviceMode.FpgaActive);
 
+            // Only the first panel is attached, the second one gives the scroll window room to move.
+            TestBoard.SetPanelLayout(CanvasWidth / 32, CanvasWidth / 32, SignTest.PanelFlags.None);
+            TestBoard.Scroll(0);
+            ScrollColumn = 0;
         }
         SignTest TestBoard;
 
+        // The panel is a window into a canvas wider than itself. When a new frame is the previous one moved left by a
+        // few pixels, only the newly revealed columns are sent (off screen) and the hardware window is scrolled onto them.
+        const int CanvasWidth = 64;
+        const int MaxScrollStep = 8;
+        int ScrollColumn;
+        uint[] LastFrame;
+
+        // Returns how many pixels left frame is from the previous one (0 if it's identical), or -1 if it isn't a scroll.
+        int ScrollStep(uint[] previous, uint[] frame)
+        {
+            if (previous == null)
+                return -1;
+            for (int step = 0; step <= MaxScrollStep; step++)
+            {
+                bool match = true;
+                for (int y = 0; y < 32 && match; y++)
+                {
+                    for (int x = 0; x < 32 - step; x++)
+                    {
+                        if (frame[x + y * 32] != previous[x + step + y * 32])
+                        {
+                            match = false;
+                            break;
+                        }
+                    }
+                }
+                if (match)
+                    return step;
+            }
+            return -1;
+        }
+
+        void SendFrame(uint[] frame)
+        {
+            int step = ScrollStep(LastFrame, frame);
+            LastFrame = frame;
+            if (step == 0)
+                return;
+
+            if (step > 0)
+            {
+                // Revealed columns go just past the right edge of the window.
+                uint[] columns = new uint[step * 32];
+                for (int y = 0; y < 32; y++)
+                    Array.Copy(frame, y * 32 + 32 - step, columns, y * step, step);
+                TestBoard.WriteWrapped(ScrollColumn + 32, step, CanvasWidth, columns);
+                ScrollColumn = (ScrollColumn + step) % CanvasWidth;
+                TestBoard.Scroll(ScrollColumn);
+            }
+            else
+            {
+                TestBoard.WriteWrapped(ScrollColumn, 32, CanvasWidth, frame);
+            }
+        }
+
         SignConfiguration CurrentConfig;
 
         public bool SupportsConfiguration(SignConfiguration configuration)
@@ -71,7 +130,9 @@ namespace SignControl
                             }
                         }
 
-                        TestBoard.SendImage32x32(i, elementData);
+                        // Currently only supporting the first 32x32 matrix.
+                        if (i == 0)
+                            SendFrame(elementData);
                     }
                     catch { } // Exceptions are generally due to configuration changes leading bitmap changes.
                 }
@@ -31,6 +31,8 @@ namespace SignTestInterface
             SetMode = 0x11,
             SetLed = 0x12,
             GetButton = 0x13,
+            PowerLimits = 0x16,
+            PowerFault = 0x17,
 
             ScratchPad = 0x18,
             ClearScratchPad = 0x19, // Set to all FF
@@ -46,6 +48,41 @@ namespace SignTestInterface
 
             FlashCrc32 = 0x28, // 64k block
 
+            GammaTable = 0x30,
+            GammaControl = 0x31,
+            PanelLayout = 0x32,
+            Playback = 0x33,
+            PlaybackStatus = 0x34,
+            AdcConfig = 0x36,
+            AdcLoad = 0x37,
+            BootTiming = 0x38,
+            UsbBulkCost = 0x3B,
+            PageFlip = 0x3C,
+            Scroll = 0x3D,
+            FrameQueueStatus = 0x3E,
+            SofClock = 0x3F,
+            DisplayControl = 0x42, // (0x41 is the OS descriptor vendor code)
+        }
+
+        enum StreamCommand
+        {
+            WritePixels = 0x01,
+            FillRect = 0x02,
+            HLine = 0x03,
+            VLine = 0x04,
+            Glyph = 0x06,
+            Present = 0x08,
+            Scroll = 0x09,
+            PresentAt = 0x0A,
+            DrawAsset = 0x0C,
+            DrawAssetLz = 0x0D,
+        }
+
+        enum GammaOperation
+        {
+            RestoreDefaults = 0,
+            Load = 1,
+            Save = 2
         }
 
         public enum DeviceMode
@@ -57,9 +94,86 @@ namespace SignTestInterface
             FpgaActive = 4
         }
 
+        public enum PlayMode
+        {
+            Stop = 0,
+            Once = 1,
+            Loop = 2,
+            PingPong = 3
+        }
+
+        [Flags]
+        public enum PanelFlags
+        {
+            None = 0,
+            Serpentine = 1, // Chain runs right to left on odd rows, those panels are upside down
+            HalfHeight = 2 // 32x16 panels
+        }
+
+        public enum PowerFault
+        {
+            None = 0,
+            VinLow = 1,
+            VinHigh = 2,
+            Low3v3 = 3,
+            High3v3 = 4,
+            Low1v2 = 5,
+            High1v2 = 6
+        }
+
+        public enum AdcMode
+        {
+            Burst = 0, // ADC scans continuously, one interrupt per scan
+            Timer = 1 // A timer starts each scan, for low sample rates
+        }
+
+        public enum BootMilestone
+        {
+            Start = 0,
+            DeviceUID,
+            OscStarted,
+            PllLocked,
+            ClockSwitched,
+            Peripherals,
+            UsbConnect,
+            UsbReset,
+            UsbAddress,
+            UsbConfigured,
+            Count
+        }
+
+        public class SofClock
+        {
+            public uint Clock; // Device clock in ms, as of the last SOF
+            public int Frame; // USB frame number of the last SOF
+            public int Samples; // SOFs measured since the last read
+            public int MaxJitter, MeanJitter; // How far SOFs landed from where they were expected, in us (device interrupt latency included)
+        }
+
+        // One glyph of a font, for DrawText. Bits are rows of (Width+7)/8 bytes, most significant bit is the leftmost pixel.
+        public class FontGlyph
+        {
+            public int Codepoint; // Basic multilingual plane only
+            public int Width, Advance;
+            public byte[] Bits;
+        }
+
+        public class AssetInfo
+        {
+            public uint Key;
+            public int Address; // Flash address, for reading it back with FlashRead
+            public int Length;
+        }
+
+        // Sense dividers for VIN, 3V3, 1V2 (see SignTestStatus)
+        static readonly float[] RailDivider = { 3, 2, 2 };
+
         public const int FlashSectorSize = 4096;
         public const int FlashBlockSize = 65536;
 
+        const byte BulkOutPipe = 0x03;
+        const byte BulkInPipe = 0x83;
+
 
         byte[] VendorRequestIn(DeviceRequest request, ushort value, ushort index, ushort length)
         {
@@ -137,23 +251,296 @@ namespace SignTestInterface
             // Currently only supporting the first 32x32 matrix.
             if (unit != 0) return;
 
-            // Send one scanline at a time (99 bytes)
-            for (int y = 0; y < 32; y++)
+            // Send the whole frame linearly, the device takes care of the FPGA address layout.
+            SendCanvas(ImageData);
+        }
+
+        // Stream pixels (3 bytes each, R,G,B) into the FPGA framebuffer over the bulk endpoint. The device applies its gamma tables.
+        public void WritePixels(int address, byte[] rgbData)
+        {
+            int count = rgbData.Length / 3;
+            byte[] packet = new byte[5 + count * 3];
+            packet[0] = (byte)StreamCommand.WritePixels;
+            packet[1] = (byte)(address & 0xFF);
+            packet[2] = (byte)(address >> 8);
+            packet[3] = (byte)(count & 0xFF);
+            packet[4] = (byte)(count >> 8);
+            Array.Copy(rgbData, 0, packet, 5, count * 3);
+            Device.WritePipe(BulkOutPipe, packet);
+        }
+
+        // Show everything drawn since the last Present, starting at the next display frame.
+        // After the first Present, drawing goes to a hidden page, so each frame should be drawn completely before presenting it.
+        // Panel chains longer than half the FPGA memory can't be double buffered, and keep drawing in place.
+        public void Present()
+        {
+            Device.WritePipe(BulkOutPipe, new byte[] { (byte)StreamCommand.Present });
+        }
+
+        // Like Present, but the frame is held on the device and shown on the USB SOF with the given (11 bit) frame number.
+        // Targets must be less than a second ahead. The device has room for a few frames, depending on the panel count.
+        public void PresentAt(int usbFrame)
+        {
+            Device.WritePipe(BulkOutPipe, new byte[] { (byte)StreamCommand.PresentAt, (byte)(usbFrame & 0xFF), (byte)((usbFrame >> 8) & 0x07) });
+        }
+
+        public const int UsbFrameMask = 0x7FF;
+
+        // Returns frames queued, the current USB frame number, frames shown late, frames that arrived with the queue full,
+        // the most frames any frame was late by, and the longest the stream held the SOF interrupt off (us).
+        public int[] GetFrameQueueStatus(bool clearCounters = false)
+        {
+            byte[] data = VendorRequestIn(DeviceRequest.FrameQueueStatus, (ushort)(clearCounters ? 1 : 0), 0, 10);
+            return new int[] { data[0], BitConverter.ToUInt16(data, 2), BitConverter.ToUInt16(data, 4), BitConverter.ToUInt16(data, 6), data[1], BitConverter.ToUInt16(data, 8) };
+        }
+
+        // Check that queued frames land on their targets while the stream is busy: draws count full frames of pixel data
+        // (which keeps the device's stream passes at their longest), queueing each one interval USB frames after the last.
+        // Returns the frame queue status over the run (see GetFrameQueueStatus); frames late should be 0.
+        public int[] MeasureFrameQueue(int canvasPixels, int count = 100, int interval = 10)
+        {
+            Present(); // Draw into the back page from here on
+            GetFrameQueueStatus(true);
+            int target = GetFrameQueueStatus()[1] + 50;
+            byte[] pixels = new byte[canvasPixels * 3];
+            for (int i = 0; i < count; i++)
             {
-                byte[] scanline = new byte[99];
-                int address = y * 32;
-                if (y >= 16) address = (y + 16) * 32; // Early FPGA software issues.
-                scanline[1] = (byte)(address >> 8);
-                scanline[2] = (byte)(address & 0xFF);
+                for (int p = 0; p < pixels.Length; p++)
+                    pixels[p] = (byte)(i * 8 + p);
+                WritePixels(0, pixels);
+                PresentAt(target & UsbFrameMask);
+                target += interval;
+            }
+
+            DateTime timeout = DateTime.Now.AddSeconds(2);
+            while (GetFrameQueueStatus()[0] > 0 && DateTime.Now < timeout)
+                System.Threading.Thread.Sleep(interval);
+            return GetFrameQueueStatus(true);
+        }
+
+        // Go back to drawing directly on the displayed page.
+        public void SingleBuffer()
+        {
+            VendorRequestIn(DeviceRequest.PageFlip, 0, 0, 1);
+        }
+
+        // Hardware scrolling: the panel shows a window into the first row of the canvas, starting at column x and wrapping around
+        // at the canvas width. Sent in order with the drawing stream, so columns drawn off screen first are in place when revealed.
+        public void Scroll(int x)
+        {
+            Device.WritePipe(BulkOutPipe, new byte[] { (byte)StreamCommand.Scroll, (byte)(x & 0xFF), (byte)(x >> 8) });
+        }
+
+        public const int ScrollTickMs = 10;
+
+        // Scroll continuously on the device, from column x. Positive rates scroll the content left.
+        public void SetAutoScroll(int x, double pixelsPerSecond)
+        {
+            short rate = (short)Math.Round(pixelsPerSecond * ScrollTickMs / 1000 * 256);
+            byte[] state = new byte[4];
+            BitConverter.GetBytes((ushort)x).CopyTo(state, 0);
+            BitConverter.GetBytes(rate).CopyTo(state, 2);
+            VendorRequestOut(DeviceRequest.Scroll, 0, 0, state);
+        }
 
-                for (int i = 0; i < 32; i++)
+        public int GetScrollColumn()
+        {
+            byte[] state = VendorRequestIn(DeviceRequest.Scroll, 0, 0, 4);
+            return BitConverter.ToUInt16(state, 0);
+        }
+
+        // Write a block of pixels (ARGB, width columns per row) at column x of the top rows of a canvas canvasWidth pixels wide,
+        // wrapping around to column 0 at the right edge like the scroll window does. Sent as a single transfer.
+        public void WriteWrapped(int x, int width, int canvasWidth, uint[] image)
+        {
+            int rows = image.Length / width;
+            List<byte> packet = new List<byte>();
+            for (int y = 0; y < rows; y++)
+            {
+                int column = 0;
+                while (column < width)
                 {
-                    scanline[3 + i * 3] = (byte)((ImageData[i + y * 32] >> 16) & 0xFF);
-                    scanline[3 + i * 3 + 1] = (byte)((ImageData[i + y * 32] >> 8) & 0xFF);
-                    scanline[3 + i * 3 + 2] = (byte)(ImageData[i + y * 32] & 0xFF);
+                    int start = (x + column) % canvasWidth;
+                    int count = Math.Min(width - column, canvasWidth - start);
+                    int address = y * canvasWidth + start;
+                    packet.Add((byte)StreamCommand.WritePixels);
+                    packet.Add((byte)(address & 0xFF));
+                    packet.Add((byte)(address >> 8));
+                    packet.Add((byte)(count & 0xFF));
+                    packet.Add((byte)(count >> 8));
+                    for (int i = 0; i < count; i++)
+                    {
+                        uint pixel = image[y * width + column + i];
+                        packet.Add((byte)((pixel >> 16) & 0xFF));
+                        packet.Add((byte)((pixel >> 8) & 0xFF));
+                        packet.Add((byte)(pixel & 0xFF));
+                    }
+                    column += count;
                 }
-                FpgaSpi(scanline);
             }
+            Device.WritePipe(BulkOutPipe, packet.ToArray());
+        }
+
+        // Brightness is the on-time of the least significant bit plane (default 16), higher values lower the refresh rate.
+        // Fewer bit planes (1-8) trade color depth for refresh rate. Scan rows is per panel half (16, or 8 for 1/8 scan panels).
+        public void SetDisplayControl(int brightness, int bitPlanes = 8, int scanRows = 16, bool blank = false)
+        {
+            byte[] control = new byte[] { (byte)brightness, (byte)bitPlanes, (byte)scanRows, (byte)(blank ? 1 : 0) };
+            VendorRequestOut(DeviceRequest.DisplayControl, 0, 0, control);
+        }
+
+        // Returns brightness, bit planes, scan rows and blank (1 = LEDs off).
+        public int[] GetDisplayControl()
+        {
+            byte[] control = VendorRequestIn(DeviceRequest.DisplayControl, 0, 0, 4);
+            return new int[] { control[0], control[1], control[2], control[3] };
+        }
+
+        // Configure how the chain of panels is arranged into one canvas. Rotation is in units of 90 degrees clockwise.
+        public void SetPanelLayout(int panelCount, int panelsAcross, PanelFlags flags, int rotation = 0)
+        {
+            byte[] layout = new byte[] { (byte)panelCount, (byte)panelsAcross, (byte)flags, (byte)rotation };
+            VendorRequestOut(DeviceRequest.PanelLayout, 0, 0, layout);
+        }
+
+        // Send a full canvas (width*height pixels in ARGB format) as one linear stream.
+        public void SendCanvas(uint[] ImageData)
+        {
+            byte[] frame = new byte[ImageData.Length * 3];
+            for (int i = 0; i < ImageData.Length; i++)
+            {
+                frame[i * 3] = (byte)((ImageData[i] >> 16) & 0xFF);
+                frame[i * 3 + 1] = (byte)((ImageData[i] >> 8) & 0xFF);
+                frame[i * 3 + 2] = (byte)(ImageData[i] & 0xFF);
+            }
+            // Pixel count in a single write command is limited to 16 bits.
+            for (int start = 0; start < ImageData.Length; start += 0x8000)
+            {
+                int count = Math.Min(0x8000, ImageData.Length - start);
+                byte[] part = new byte[count * 3];
+                Array.Copy(frame, start * 3, part, 0, count * 3);
+                WritePixels(start, part);
+            }
+        }
+
+        // Drawing commands, executed on the device. Colors are in ARGB format (alpha is ignored)
+        public void FillRect(int x, int y, int width, int height, uint color)
+        {
+            Device.WritePipe(BulkOutPipe, StreamPacket(StreamCommand.FillRect, new int[] { x, y, width, height }, color));
+        }
+
+        public void HLine(int x, int y, int length, uint color)
+        {
+            Device.WritePipe(BulkOutPipe, StreamPacket(StreamCommand.HLine, new int[] { x, y, length }, color));
+        }
+
+        public void VLine(int x, int y, int length, uint color)
+        {
+            Device.WritePipe(BulkOutPipe, StreamPacket(StreamCommand.VLine, new int[] { x, y, length }, color));
+        }
+
+        // Glyph bits are rows of (width+7)/8 bytes, most significant bit is the leftmost pixel.
+        public void Glyph(int x, int y, int width, int height, byte[] bits, uint foreground, uint background, bool transparent = false)
+        {
+            int rowBytes = (width + 7) / 8;
+            if (width > 255 || height > 255 || bits.Length < rowBytes * height)
+                throw new ArgumentException("Invalid glyph size");
+
+            byte[] packet = new byte[14 + rowBytes * height];
+            packet[0] = (byte)StreamCommand.Glyph;
+            packet[1] = (byte)(x & 0xFF);
+            packet[2] = (byte)(x >> 8);
+            packet[3] = (byte)(y & 0xFF);
+            packet[4] = (byte)(y >> 8);
+            packet[5] = (byte)width;
+            packet[6] = (byte)height;
+            packet[7] = (byte)(transparent ? 1 : 0);
+            packet[8] = (byte)((foreground >> 16) & 0xFF);
+            packet[9] = (byte)((foreground >> 8) & 0xFF);
+            packet[10] = (byte)(foreground & 0xFF);
+            packet[11] = (byte)((background >> 16) & 0xFF);
+            packet[12] = (byte)((background >> 8) & 0xFF);
+            packet[13] = (byte)(background & 0xFF);
+            Array.Copy(bits, 0, packet, 14, rowBytes * height);
+            Device.WritePipe(BulkOutPipe, packet);
+        }
+
+        // Draw a line of text at (x,y) with glyph commands, returns the width drawn. Characters without a glyph are skipped.
+        // To scroll it, draw it off screen on the first row of panels and use SetAutoScroll.
+        public int DrawText(string text, IEnumerable<FontGlyph> font, int height, int x, int y, uint foreground, uint background, bool transparent = false)
+        {
+            Dictionary<int, FontGlyph> glyphs = font.ToDictionary(g => g.Codepoint);
+            int start = x;
+            foreach (char c in text)
+            {
+                FontGlyph g;
+                if (!glyphs.TryGetValue(c, out g))
+                    continue;
+                if (g.Width > 0)
+                    Glyph(x, y, g.Width, height, g.Bits, foreground, background, transparent);
+                x += g.Advance;
+            }
+            return x - start;
+        }
+
+        byte[] StreamPacket(StreamCommand command, int[] values, uint color)
+        {
+            byte[] packet = new byte[1 + values.Length * 2 + 3];
+            packet[0] = (byte)command;
+            for (int i = 0; i < values.Length; i++)
+            {
+                packet[1 + i * 2] = (byte)(values[i] & 0xFF);
+                packet[2 + i * 2] = (byte)(values[i] >> 8);
+            }
+            packet[packet.Length - 3] = (byte)((color >> 16) & 0xFF);
+            packet[packet.Length - 2] = (byte)((color >> 8) & 0xFF);
+            packet[packet.Length - 1] = (byte)(color & 0xFF);
+            return packet;
+        }
+
+        // The device applies one gamma curve to all three channels, then scales each channel by its balance (255 = full).
+        public byte[] ReadGammaCurve()
+        {
+            return VendorRequestIn(DeviceRequest.GammaTable, 0, 0, 256);
+        }
+
+        public void WriteGammaCurve(byte[] curve)
+        {
+            if (curve.Length != 256)
+                throw new ArgumentException("Gamma curves must be 256 entries.");
+            VendorRequestOut(DeviceRequest.GammaTable, 0, 0, curve);
+        }
+
+        // Returns R, G, B balance.
+        public byte[] ReadColorBalance()
+        {
+            return VendorRequestIn(DeviceRequest.GammaTable, 1, 0, 3);
+        }
+
+        public void WriteColorBalance(byte red, byte green, byte blue)
+        {
+            VendorRequestOut(DeviceRequest.GammaTable, 1, 0, new byte[] { red, green, blue });
+        }
+
+        public void GammaRestoreDefaults()
+        {
+            CheckGammaResult(VendorRequestIn(DeviceRequest.GammaControl, (ushort)GammaOperation.RestoreDefaults, 0, 1));
+        }
+
+        public void GammaLoad()
+        {
+            CheckGammaResult(VendorRequestIn(DeviceRequest.GammaControl, (ushort)GammaOperation.Load, 0, 1));
+        }
+
+        public void GammaSave()
+        {
+            CheckGammaResult(VendorRequestIn(DeviceRequest.GammaControl, (ushort)GammaOperation.Save, 0, 1));
+        }
+
+        void CheckGammaResult(byte[] result)
+        {
+            if (result[0] != 1)
+                throw new Exception("Gamma operation unsuccessful");
         }
 
         void CheckAddress(int address, int alignment)
@@ -197,6 +584,394 @@ namespace SignTestInterface
             throw new NotImplementedException(); // Also not implemented in the microcontroller currently.
         }
 
+        public const int LzWindowSize = 224;
+        const int LzMinMatch = 3;
+        const int LzMaxMatch = 0x7F + LzMinMatch;
+
+        // Compress data for the device's LZ decoder. Tokens 0x00-0x7F are followed by token+1 literal bytes, tokens 0x80-0xFF
+        // copy (token&0x7F)+3 bytes starting (next byte)+1 bytes back, at most LzWindowSize. The window starts out as zeros.
+        public static byte[] LzCompress(byte[] data)
+        {
+            List<byte> output = new List<byte>();
+            List<byte> literals = new List<byte>();
+            Func<int, byte> at = i => (i < 0) ? (byte)0 : data[i];
+            Action flushLiterals = () =>
+            {
+                if (literals.Count == 0)
+                    return;
+                output.Add((byte)(literals.Count - 1));
+                output.AddRange(literals);
+                literals.Clear();
+            };
+
+            int position = 0;
+            while (position < data.Length)
+            {
+                int bestLength = 0, bestDistance = 0;
+                for (int distance = 1; distance <= LzWindowSize; distance++)
+                {
+                    int length = 0;
+                    while (length < LzMaxMatch && position + length < data.Length && at(position + length - distance) == data[position + length])
+                        length++;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = distance;
+                    }
+                }
+
+                if (bestLength >= LzMinMatch)
+                {
+                    flushLiterals();
+                    output.Add((byte)(0x80 | (bestLength - LzMinMatch)));
+                    output.Add((byte)(bestDistance - 1));
+                    position += bestLength;
+                }
+                else
+                {
+                    literals.Add(data[position++]);
+                    if (literals.Count == 128)
+                        flushLiterals();
+                }
+            }
+            flushLiterals();
+            return output.ToArray();
+        }
+
+        // Write an animation container to flash at a 64k block boundary, for standalone playback.
+        // Each frame is a full canvas of R,G,B data, durations are in ms. Compressed frames are stored that way when it makes them smaller.
+        public void UploadAnimation(int address, int pixelCount, IList<byte[]> frames, IList<int> durations, bool compress = false)
+        {
+            CheckAddress(address, FlashBlockSize);
+            const int HeaderSize = 16;
+            const int FrameEntrySize = 8;
+            const ushort FrameFlagLz = 1;
+            int frameSize = pixelCount * 3;
+            int dataStart = HeaderSize + FrameEntrySize * frames.Count;
+
+            List<byte[]> frameData = new List<byte[]>();
+            foreach (byte[] frame in frames)
+            {
+                byte[] raw = new byte[frameSize];
+                Array.Copy(frame, raw, frameSize);
+                byte[] packed = compress ? LzCompress(raw) : null;
+                frameData.Add((packed != null && packed.Length < frameSize) ? packed : raw);
+            }
+            byte[] container = new byte[dataStart + frameData.Sum(f => f.Length)];
+
+            Array.Copy(BitConverter.GetBytes(0x4D494E41), 0, container, 0, 4); // "ANIM"
+            Array.Copy(BitConverter.GetBytes((ushort)frames.Count), 0, container, 4, 2);
+            Array.Copy(BitConverter.GetBytes(pixelCount), 0, container, 8, 4);
+            Array.Copy(BitConverter.GetBytes(container.Length), 0, container, 12, 4);
+            int offset = dataStart;
+            for (int i = 0; i < frames.Count; i++)
+            {
+                ushort flags = (frameData[i].Length != frameSize) ? FrameFlagLz : (ushort)0;
+                Array.Copy(BitConverter.GetBytes(offset), 0, container, HeaderSize + FrameEntrySize * i, 4);
+                Array.Copy(BitConverter.GetBytes((ushort)durations[i]), 0, container, HeaderSize + FrameEntrySize * i + 4, 2);
+                Array.Copy(BitConverter.GetBytes(flags), 0, container, HeaderSize + FrameEntrySize * i + 6, 2);
+                Array.Copy(frameData[i], 0, container, offset, frameData[i].Length);
+                offset += frameData[i].Length;
+            }
+
+            FlashEraseRegion(address, container.Length);
+            FlashWrite(address, container);
+        }
+
+        public void PlayAnimation(int address, PlayMode mode)
+        {
+            CheckAddress(address, FlashBlockSize);
+            if (VendorRequestIn(DeviceRequest.Playback, (ushort)mode, (ushort)(address / FlashBlockSize), 1)[0] != 1)
+                throw new Exception("Unable to start animation");
+        }
+
+        public void StopAnimation()
+        {
+            VendorRequestIn(DeviceRequest.Playback, (ushort)PlayMode.Stop, 0, 1);
+        }
+
+        public int GetAnimationFrame()
+        {
+            byte[] data = VendorRequestIn(DeviceRequest.PlaybackStatus, 0, 0, 4);
+            return BitConverter.ToUInt16(data, 2);
+        }
+
+        // Asset store layout, see asset.h. The device only reads the index; everything that writes it lives here.
+        const int AssetIndex = 0x080000;
+        const int AssetData = 0x081000;
+        const int AssetEnd = 0x1FF000;
+        const uint AssetIndexMagic = 0x58444E49; // "INDX"
+        const uint AssetStateLive = 0x4556494C; // "LIVE"
+        const uint AssetNoKey = 0xFFFFFFFF;
+        const int AssetEntrySize = 16;
+        const int AssetIndexEntries = (FlashSectorSize - 16) / AssetEntrySize;
+
+        class AssetIndexState
+        {
+            public bool Formatted;
+            public int Used; // Entries written
+            public int Next = AssetData; // End of the newest asset, where allocation continues
+            public bool[] Live = new bool[(AssetEnd - AssetData) / FlashSectorSize]; // Sectors holding live assets
+            public List<int> Found = new List<int>(); // Index addresses of the key's live entries, the last one is current
+            public List<AssetInfo> Assets = new List<AssetInfo>(); // Live assets
+        }
+
+        AssetIndexState ReadAssetIndex(uint key)
+        {
+            AssetIndexState index = new AssetIndexState();
+            byte[] sector = FlashRead(AssetIndex, FlashSectorSize);
+            if (BitConverter.ToUInt32(sector, 0) != AssetIndexMagic)
+                return index;
+            index.Formatted = true;
+
+            for (int i = 0; i < AssetIndexEntries; i++)
+            {
+                int offset = 16 + i * AssetEntrySize;
+                AssetInfo entry = new AssetInfo();
+                entry.Key = BitConverter.ToUInt32(sector, offset);
+                entry.Address = BitConverter.ToInt32(sector, offset + 4);
+                entry.Length = BitConverter.ToInt32(sector, offset + 8);
+                uint state = BitConverter.ToUInt32(sector, offset + 12);
+                if (entry.Key == AssetNoKey && entry.Address == -1)
+                    break;
+                index.Used = i + 1;
+
+                // Same check as asset_valid on the device, an interrupted write may have left anything.
+                if (entry.Address < AssetData || entry.Address >= AssetEnd || (entry.Address & (FlashSectorSize - 1)) != 0
+                    || entry.Length <= 0 || entry.Length > AssetEnd - entry.Address)
+                    continue;
+                int sectors = (entry.Length + FlashSectorSize - 1) / FlashSectorSize;
+                index.Next = entry.Address + sectors * FlashSectorSize;
+                if (state != AssetStateLive)
+                    continue;
+
+                int first = (entry.Address - AssetData) / FlashSectorSize;
+                for (int s = first; s < first + sectors; s++)
+                    index.Live[s] = true;
+                index.Assets.RemoveAll(a => a.Key == entry.Key);
+                index.Assets.Add(entry);
+                if (entry.Key == key)
+                    index.Found.Add(AssetIndex + offset);
+            }
+            if (index.Next >= AssetEnd)
+                index.Next = AssetData;
+            return index;
+        }
+
+        // First free run of sectors after the newest asset, wrapping around. Returns 0 if there isn't one.
+        int AllocateAsset(AssetIndexState index, int length)
+        {
+            int count = (length + FlashSectorSize - 1) / FlashSectorSize;
+            int total = index.Live.Length;
+            int start = (index.Next - AssetData) / FlashSectorSize;
+            for (int i = 0; i < total; i++)
+            {
+                int first = (start + i) % total;
+                if (first + count > total)
+                    continue;
+                int s = first;
+                while (s < first + count && !index.Live[s])
+                    s++;
+                if (s == first + count)
+                    return AssetData + first * FlashSectorSize;
+            }
+            return 0;
+        }
+
+        void RetireAsset(int entryAddress)
+        {
+            FlashWrite(entryAddress + 12, new byte[4]); // Clear the state word, no erase needed
+        }
+
+        // Store data in flash under a key, replacing any asset with the same key. The device must be in a mode with flash access.
+        public AssetInfo UploadAsset(uint key, byte[] data)
+        {
+            if (key == AssetNoKey || data.Length == 0 || data.Length > AssetEnd - AssetData)
+                throw new ArgumentException("Invalid asset");
+            AssetIndexState index = ReadAssetIndex(key);
+            if (!index.Formatted)
+            {
+                FormatAssets();
+                index = ReadAssetIndex(key);
+            }
+            if (index.Used >= AssetIndexEntries)
+                throw new Exception("Asset index is full, format the store");
+
+            AssetInfo info = new AssetInfo();
+            info.Key = key;
+            info.Length = data.Length;
+            info.Address = AllocateAsset(index, data.Length);
+            if (info.Address == 0)
+                throw new Exception("No room for the asset");
+
+            // The sectors may still hold an old asset.
+            FlashEraseRegion(info.Address, data.Length);
+            FlashWrite(info.Address, data);
+
+            byte[] entry = new byte[AssetEntrySize];
+            BitConverter.GetBytes(key).CopyTo(entry, 0);
+            BitConverter.GetBytes(info.Address).CopyTo(entry, 4);
+            BitConverter.GetBytes(info.Length).CopyTo(entry, 8);
+            BitConverter.GetBytes(AssetStateLive).CopyTo(entry, 12);
+            FlashWrite(AssetIndex + 16 + index.Used * AssetEntrySize, entry);
+
+            // Only once the new entry is in place, so the key is never left without one.
+            foreach (int old in index.Found)
+                RetireAsset(old);
+            return info;
+        }
+
+        // Returns null if the store doesn't have the asset.
+        public AssetInfo FindAsset(uint key)
+        {
+            return ReadAssetIndex(key).Assets.FirstOrDefault(a => a.Key == key);
+        }
+
+        public bool DeleteAsset(uint key)
+        {
+            AssetIndexState index = ReadAssetIndex(key);
+            foreach (int old in index.Found)
+                RetireAsset(old);
+            return index.Found.Count > 0;
+        }
+
+        // Returns free bytes and the number of assets stored.
+        public int[] GetAssetStats()
+        {
+            AssetIndexState index = ReadAssetIndex(AssetNoKey);
+            return new int[] { index.Live.Count(live => !live) * FlashSectorSize, index.Assets.Count };
+        }
+
+        public void FormatAssets()
+        {
+            FlashEraseRegion(AssetIndex, FlashSectorSize);
+            byte[] header = new byte[16];
+            BitConverter.GetBytes(AssetIndexMagic).CopyTo(header, 0);
+            FlashWrite(AssetIndex, header);
+        }
+
+        // Draw an asset of R,G,B pixel data into the framebuffer from a linear address. pixelCount = 0 draws the whole asset.
+        // Assets uploaded as LzCompress output need compressed set; drawing them stops playback.
+        public void DrawAsset(uint key, int address, int pixelCount = 0, bool compressed = false)
+        {
+            byte[] packet = new byte[9];
+            packet[0] = (byte)(compressed ? StreamCommand.DrawAssetLz : StreamCommand.DrawAsset);
+            BitConverter.GetBytes(key).CopyTo(packet, 1);
+            BitConverter.GetBytes((ushort)address).CopyTo(packet, 5);
+            BitConverter.GetBytes((ushort)pixelCount).CopyTo(packet, 7);
+            Device.WritePipe(BulkOutPipe, packet);
+        }
+
+        // Rail limits in volts, for VIN, 3V3, 1V2. filterUs = time a rail must be out of limits before power is cut (at least one ADC scan).
+        public void SetPowerLimits(float[] low, float[] high, float hysteresis = 0.04f, int filterUs = 1000)
+        {
+            byte[] limits = new byte[16];
+            for (int i = 0; i < 3; i++)
+            {
+                BitConverter.GetBytes(RailToRaw(low[i], i)).CopyTo(limits, i * 2);
+                BitConverter.GetBytes(RailToRaw(high[i], i)).CopyTo(limits, 6 + i * 2);
+            }
+            BitConverter.GetBytes(RailToRaw(hysteresis, 0)).CopyTo(limits, 12);
+            BitConverter.GetBytes((ushort)filterUs).CopyTo(limits, 14);
+            VendorRequestOut(DeviceRequest.PowerLimits, 0, 0, limits);
+        }
+
+        ushort RailToRaw(float volts, int rail)
+        {
+            return (ushort)Math.Min(0x3FFF, Math.Max(0, volts / RailDivider[rail] / 3.3f * 0x3FFF));
+        }
+
+        public PowerFault GetPowerFault()
+        {
+            return (PowerFault)VendorRequestIn(DeviceRequest.PowerFault, 0, 0, 6)[0];
+        }
+
+        public void ClearPowerFault()
+        {
+            VendorRequestIn(DeviceRequest.PowerFault, 1, 0, 6);
+        }
+
+        // rate = scans per second, oversample = log2 of scans averaged for ReadStatus (0-4)
+        public void ConfigureAdc(int rate, AdcMode mode = AdcMode.Burst, int oversample = 4)
+        {
+            byte[] config = new byte[8];
+            BitConverter.GetBytes((ushort)rate).CopyTo(config, 0);
+            config[2] = 7; // All rails are always scanned
+            config[3] = (byte)mode;
+            config[4] = (byte)oversample;
+            VendorRequestOut(DeviceRequest.AdcConfig, 0, 0, config);
+        }
+
+        // Fraction of the CPU spent in the ADC interrupt over the last 10ms
+        public double GetAdcLoad()
+        {
+            byte[] data = VendorRequestIn(DeviceRequest.AdcLoad, 0, 0, 8);
+            return BitConverter.ToUInt16(data, 6) / 1000.0;
+        }
+
+        // Microseconds from main() to each boot milestone, -1 if not reached. The last entry is the current device time.
+        public long[] GetBootTiming()
+        {
+            int count = (int)BootMilestone.Count + 1;
+            byte[] data = VendorRequestIn(DeviceRequest.BootTiming, 0, 0, (ushort)(count * 4));
+            long[] times = new long[count];
+            for (int i = 0; i < count; i++)
+            {
+                uint t = BitConverter.ToUInt32(data, i * 4);
+                times[i] = (t == 0xFFFFFFFF) ? -1 : t;
+            }
+            return times;
+        }
+
+        // Cost of the bulk endpoint handler since the last call: cycles spent, handler calls, packets moved.
+        // cycles / packets is the per-packet overhead.
+        public uint[] GetUsbBulkCost()
+        {
+            byte[] data = VendorRequestIn(DeviceRequest.UsbBulkCost, 0, 0, 12);
+            return new uint[] { BitConverter.ToUInt32(data, 0), BitConverter.ToUInt32(data, 4), BitConverter.ToUInt32(data, 8) };
+        }
+
+        public SofClock GetSofClock()
+        {
+            byte[] data = VendorRequestIn(DeviceRequest.SofClock, 0, 0, 12);
+            return new SofClock()
+            {
+                Clock = BitConverter.ToUInt32(data, 0),
+                Frame = BitConverter.ToUInt16(data, 4),
+                Samples = BitConverter.ToUInt16(data, 6),
+                MaxJitter = BitConverter.ToUInt16(data, 8),
+                MeanJitter = BitConverter.ToUInt16(data, 10)
+            };
+        }
+
+        // Set the device clock so it read 'clock' at SOF 'frame' (which must be within the last 2 seconds).
+        public void SetSofClock(uint clock, int frame)
+        {
+            byte[] data = new byte[8];
+            BitConverter.GetBytes(clock).CopyTo(data, 0);
+            BitConverter.GetBytes(frame & UsbFrameMask).CopyTo(data, 4);
+            VendorRequestOut(DeviceRequest.SofClock, 0, 0, data);
+        }
+
+        // Put boards on the same host controller on one timeline, starting at 'clock' now. Boards on other controllers
+        // see different SOFs, and can't be synchronized this way.
+        public static void SynchronizeClocks(IEnumerable<SignTest> boards, uint clock)
+        {
+            SignTest[] list = boards.ToArray();
+            if (list.Length == 0)
+                return;
+            int frame = list[0].GetSofClock().Frame;
+            foreach (SignTest board in list)
+                board.SetSofClock(clock, frame);
+        }
+
+        // Queue the presented frame for a time on the device clock, less than a second ahead.
+        public void PresentAtClock(uint clock)
+        {
+            SofClock now = GetSofClock();
+            PresentAt((int)((now.Frame + (clock - now.Clock)) & UsbFrameMask));
+        }
+
         public UInt32 FlashReadId(bool useIncompatibleDevice = false)
         {
             byte[] data = VendorRequestIn(DeviceRequest.FlashReadId, (ushort)(useIncompatibleDevice ? 1 : 0), 0, 4);
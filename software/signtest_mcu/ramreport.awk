@@ -0,0 +1,55 @@
+# RAM budget report, generated from the linker map after each link.
+# Lists every symbol placed in .bss, largest first. Sizes are the distance to the next symbol,
+# so file-local statics are counted with the global symbol placed before them.
+# Usage: awk -v iram=<bytes> -v stack=<bytes> -f ramreport.awk <map file>
+
+function hex(s,    v, i)
+{
+	v = 0;
+	s = tolower(s);
+	sub(/^0x/, "", s);
+	for(i = 1; i <= length(s); i++)
+		v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1;
+	return v;
+}
+
+/^\.bss/ { inbss = 1; start = hex($2); size = hex($3); next; }
+inbss && /^[^ \t]/ { inbss = 0; }
+inbss && NF == 2 && $1 ~ /^0x/ && $2 !~ /^0x/ && $2 != "." {
+	n++;
+	addr[n] = hex($1);
+	name[n] = $2;
+}
+
+END {
+	# Sort by address
+	for(i = 2; i <= n; i++)
+	{
+		a = addr[i]; b = name[i];
+		for(j = i - 1; j >= 1 && addr[j] > a; j--) { addr[j+1] = addr[j]; name[j+1] = name[j]; }
+		addr[j+1] = a; name[j+1] = b;
+	}
+
+	count = 0;
+	if(n == 0 || addr[1] > start) { count++; len[count] = (n ? addr[1] : start + size) - start; label[count] = "(local)"; }
+	for(i = 1; i <= n; i++)
+	{
+		count++;
+		len[count] = (i < n ? addr[i+1] : start + size) - addr[i];
+		label[count] = name[i];
+	}
+
+	# Sort by size, largest first
+	for(i = 2; i <= count; i++)
+	{
+		a = len[i]; b = label[i];
+		for(j = i - 1; j >= 1 && len[j] < a; j--) { len[j+1] = len[j]; label[j+1] = label[j]; }
+		len[j+1] = a; label[j+1] = b;
+	}
+
+	for(i = 1; i <= count; i++)
+		if(len[i] > 0) printf("%6d  %s\n", len[i], label[i]);
+
+	printf("RAM: %d bytes used of %d, %d left for the stack (%d reserved)%s\n", size, iram, iram - size, stack,
+		(iram - size < stack) ? " - OVER BUDGET" : "");
+}
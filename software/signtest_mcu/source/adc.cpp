@@ -0,0 +1,203 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "lpc13xx.h"
+#include "system.h"
+#include "adc.h"
+#include "io.h"
+#include "power.h"
+#include "dpc.h"
+
+AdcConfig adc_config;
+AdcConfig adc_pending;
+
+int adc_last[3];
+
+int adc_count;
+int adc_temp[3];
+int adc_sample[3]; // Most recent raw values
+int adc_channel; // Channel being converted in timer mode
+int adc_first, adc_last_channel; // Lowest and highest enabled channel
+
+int adc_cycles, adc_calls; // Load accumulated during the current tick
+int adc_load_cycles, adc_load_calls;
+
+
+void adc_scan()
+{
+	power_check(adc_sample[0], adc_sample[1], adc_sample[2]);
+
+	for(int i=0;i<3;i++)
+		adc_temp[i] += adc_sample[i];
+	adc_count++;
+	if(adc_count == (1<<adc_config.oversample))
+	{
+		int shift = Adc_MaxOversample - adc_config.oversample;
+		for(int i=0;i<3;i++)
+		{
+			if(adc_config.channels & (1<<i))
+				adc_last[i] = adc_temp[i] << shift;
+			adc_temp[i] = 0;
+		}
+		adc_count = 0;
+	}
+}
+
+extern "C" void int_ADC(); // Once per scan of the enabled channels (burst) or once per channel (timer mode).
+void int_ADC()
+{
+	int start = TMR32B1TC;
+
+	if(adc_config.mode == AdcMode_Burst)
+	{
+		if(adc_config.channels & 1) adc_sample[0] = (AD0DR0>>6)&0x3FF;
+		if(adc_config.channels & 2) adc_sample[1] = (AD0DR1>>6)&0x3FF;
+		if(adc_config.channels & 4) adc_sample[2] = (AD0DR2>>6)&0x3FF;
+		adc_scan();
+	}
+	else
+	{
+		// Without burst the ADC converts one channel per start, so chain the rest of the scan from here.
+		adc_sample[adc_channel] = (AD0GDR>>6)&0x3FF;
+		int base = AD0CR & 0xFF00;
+		int next = adc_channel + 1;
+		while(next <= adc_last_channel && !(adc_config.channels & (1<<next))) next++;
+		if(next <= adc_last_channel)
+		{
+			adc_channel = next;
+			AD0CR = base | (1<<next) | (1<<24); // Start now
+		}
+		else
+		{
+			adc_channel = adc_first;
+			AD0CR = base | (1<<adc_first) | (4<<24); // Next scan starts on the CT32B0_MAT0 rising edge
+			adc_scan();
+		}
+	}
+
+	InterruptClear(INT_ADC);
+
+	int cycles = TMR32B1TC - start;
+	if(cycles < 0) cycles += TMR32B1MR0 + 1; // The tick timer wrapped
+	adc_cycles += cycles + Adc_IsrOverhead;
+	adc_calls++;
+}
+
+
+void adc_configure()
+{
+	InterruptDisable(INT_ADC);
+	AD0CR = 0;
+	TMR32B0TCR = 2; // Hold CT32B0 in reset
+	adc_config = adc_pending;
+
+	adc_config.channels = 7; // Power protection needs every rail
+	if(adc_config.oversample > Adc_MaxOversample) adc_config.oversample = Adc_MaxOversample;
+	if(adc_config.mode != AdcMode_Timer) adc_config.mode = AdcMode_Burst;
+	if(adc_config.rate == 0) adc_config.rate = 1;
+
+	int count = 0;
+	adc_first = -1;
+	for(int i=0;i<3;i++)
+	{
+		if(adc_config.channels & (1<<i))
+		{
+			if(adc_first < 0) adc_first = i;
+			adc_last_channel = i;
+			count++;
+		}
+	}
+
+	adc_count = 0;
+	adc_temp[0] = adc_temp[1] = adc_temp[2] = 0;
+	adc_channel = adc_first;
+
+	if(adc_config.mode == AdcMode_Burst)
+	{
+		// ADC clock = 24MHz / (CLKDIV+1), must be <= 4.5MHz. Each channel takes 11 ADC clocks.
+		int clkdiv = Adc_ClockHz / (adc_config.rate * Adc_ConversionClocks * count) - 1;
+		if(clkdiv < 5) clkdiv = 5;
+		if(clkdiv > 255) clkdiv = 255;
+
+		AD0INTEN = 1<<adc_last_channel; // Interrupt once the scan is complete.
+		AD0CR = adc_config.channels | (clkdiv<<8) | (1<<16); // BURST - hardware scan through ADC conversions.
+	}
+	else
+	{
+		// Convert as fast as possible once started, so the scan completes quickly.
+		AD0INTEN = adc_config.channels;
+		AD0CR = (1<<adc_first) | (5<<8) | (4<<24); // Start on the CT32B0_MAT0 rising edge
+
+		// MAT0 toggles on every match, so match at twice the scan rate.
+		TMR32B0PR = 0;
+		TMR32B0MCR = 2; // Reset on MR0
+		TMR32B0MR0 = Adc_ClockHz / (2 * adc_config.rate) - 1;
+		TMR32B0EMR = (3<<4); // Toggle MAT0
+		TMR32B0TCR = 1; // Enable
+	}
+
+	power_configure(); // The filter time is counted in scans
+
+	InterruptClear(INT_ADC);
+	InterruptEnable(INT_ADC);
+}
+
+void ad_init()
+{
+
+	PDRUNCFG &= ~(1<<4); // turn on power to ADC;
+	SYSAHBCLKCTRL |= (1<<9); // Clock CT32B0, which paces timer mode scans.
+	InterruptDisable(INT_ADC);
+
+	adc_last[0] = adc_last[1] = adc_last[2] = 0;
+	adc_sample[0] = adc_sample[1] = adc_sample[2] = 0;
+	adc_cycles = adc_calls = 0;
+	adc_load_cycles = adc_load_calls = 0;
+
+	InterruptSetPriority(INT_ADC,0); // HIGHEST priority.
+
+	// Default to what this board has always done: burst all 3 channels at CLKDIV 39 (~18k scans/s), 16x oversampled.
+	adc_pending.rate = 18000;
+	adc_pending.channels = 7;
+	adc_pending.mode = AdcMode_Burst;
+	adc_pending.oversample = Adc_MaxOversample;
+	adc_pending.reserved[0] = adc_pending.reserved[1] = adc_pending.reserved[2] = 0;
+	adc_configure();
+}
+
+
+// adc update worker task. every tick, wake up and do some stuff.
+void ad_work()
+{
+	dpc_suspend();
+	InterruptDisable(INT_ADC);
+
+	adc_load_cycles = adc_cycles;
+	adc_load_calls = adc_calls;
+	adc_cycles = adc_calls = 0;
+
+	InterruptEnable(INT_ADC);
+	dpc_resume();
+
+	power_tick();
+}
@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+
+#ifndef ADC_H
+#define ADC_H
+
+// ADC sampling engine for the VIN, 3V3 and 1V2 sense lines (AD0-AD2).
+// Burst mode lets the ADC scan continuously and interrupts once per scan of the enabled channels.
+// Timer mode starts each scan from CT32B0 (MAT0) and is meant for low rates, where the CPU should only wake for a result.
+// Every scan goes to the power protection; adc_last is published every 2^oversample scans.
+
+const int AdcMode_Burst = 0;
+const int AdcMode_Timer = 1;
+
+const int Adc_ClockHz = 24000000;
+const int Adc_ConversionClocks = 11;
+const int Adc_MaxOversample = 4; // 16 scans, adc_last holds the sum of 16 10bit values (2:14)
+const int Adc_IsrOverhead = 24; // Cycles of interrupt entry/exit not seen by the ISR's own timing
+
+struct AdcConfig
+{
+	unsigned short rate; // Scans per second. Burst mode is limited by the ADC clock divider to ~950-136000 / channels.
+	unsigned char channels; // Bit 0 = VIN, 1 = 3V3, 2 = 1V2. All three are always scanned, as power protection checks every rail.
+	unsigned char mode; // AdcMode_*
+	unsigned char oversample; // log2 of the scans summed into adc_last, 0-4
+	unsigned char reserved[3];
+};
+
+extern AdcConfig adc_config; // Active configuration
+extern AdcConfig adc_pending; // Written by the host, applied by adc_configure
+
+// ISR load measured over the last timer tick (10ms)
+extern int adc_load_cycles; // Cycles spent in int_ADC, including the estimated entry/exit overhead
+extern int adc_load_calls; // Number of interrupts
+
+void ad_init();
+void adc_configure(); // Validate and apply adc_pending
+void ad_work(); // Called every timer tick
+
+#endif
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "system.h"
+#include "playback.h"
+#include "lz.h"
+
+// Shared RAM for buffers that belong to mutually exclusive modes.
+// Service mode is the host poking at the flash or FPGA through the scratch pad (bringup, programming).
+// Display mode is the device running on its own: the LZ decoder window.
+// Claiming a mode stops whatever was using the other one, so each owner must claim before touching its buffer.
+
+const int Arena_None = 0;
+const int Arena_Service = 1;
+const int Arena_Display = 2;
+
+union Arena
+{
+	struct
+	{
+		unsigned char scratch_pad[256]; // One flash page
+	} service;
+
+	struct
+	{
+		unsigned char lz_window[Lz_WindowSize]; // Compressed frames and images, see lz.h
+	} display;
+};
+
+const int Arena_Budget = 256;
+STATIC_ASSERT(sizeof(Arena) <= Arena_Budget, arena_budget);
+STATIC_ASSERT(sizeof(((Arena*)0)->service.scratch_pad) == 256, scratch_pad_is_one_flash_page);
+
+extern Arena arena;
+extern int arena_mode;
+
+void arena_init();
+void arena_claim(int mode);
+
+#endif
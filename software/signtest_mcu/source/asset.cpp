@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#include "lpc13xx.h"
+#include "asset.h"
+#include "framebuffer.h"
+#include "system.h"
+#include "io.h"
+
+// Entries are programmed in one go, but one that was interrupted may hold anything.
+int asset_valid(const AssetEntry* entry)
+{
+	return entry->address >= (unsigned long)Flash_AssetData && entry->address < (unsigned long)Flash_AssetEnd
+		&& (entry->address & (Flash_SectorSize-1)) == 0 && entry->length > 0 && entry->length <= Flash_AssetEnd - entry->address;
+}
+
+int asset_open(unsigned long key, Asset* asset)
+{
+	AssetIndexHeader header;
+	AssetEntry entry;
+	int found = 0;
+
+	fb_flush();
+	SpiEngage();
+	flash_read(Flash_AssetIndex, sizeof(header), (unsigned char*)&header);
+	if(header.magic != Asset_IndexMagic || key == Asset_NoKey)
+		return 0;
+
+	for(int i=0;i<Asset_IndexEntries;i++)
+	{
+		flash_read(Flash_AssetIndex + sizeof(AssetIndexHeader) + i * sizeof(AssetEntry), sizeof(entry), (unsigned char*)&entry);
+		if(entry.key == Asset_NoKey && entry.address == 0xFFFFFFFF)
+			break; // Unused from here on
+
+		// A replace that was interrupted leaves two live entries, the later one is the new asset.
+		if(entry.key == key && entry.state == AssetState_Live && asset_valid(&entry))
+		{
+			asset->address = entry.address;
+			asset->length = entry.length;
+			found = 1;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#ifndef ASSET_H
+#define ASSET_H
+
+// Asset store in SPI flash, between the FPGA bitstream and the gamma tables.
+// Assets are blobs (images, animations) looked up by a 32bit key. Each one takes a run of whole sectors, so
+// reclaiming space never means copying: the sectors of deleted or replaced assets are simply erased when they are reused.
+// New assets go in the first free run after the newest one, wrapping around at the end, so erases go round the region in turn.
+//
+// The index is one sector of AssetEntry records after an AssetIndexHeader, appended to as assets are committed.
+// Deleting or replacing an asset clears its state word, which flash can do without an erase. Retired entries keep their
+// place, so once the index is full the store has to be formatted.
+//
+// The host manages the store through the raw flash requests (see SignTest.cs), the device only looks assets up to draw them.
+
+const int Flash_AssetIndex = 0x080000; // Below this is room for the FPGA bitstream
+const int Flash_AssetData = 0x081000;
+const int Flash_AssetEnd = 0x1FF000; // Gamma tables follow
+
+const unsigned long Asset_IndexMagic = 0x58444E49; // "INDX"
+const unsigned long AssetState_Live = 0x4556494C; // "LIVE", cleared to 0 when the asset is deleted or replaced
+const unsigned long Asset_NoKey = 0xFFFFFFFF; // Reserved, reads as an unused index entry
+
+struct AssetIndexHeader
+{
+	unsigned long magic;
+	unsigned long reserved[3];
+};
+
+struct AssetEntry
+{
+	unsigned long key;
+	unsigned long address;
+	unsigned long length;
+	unsigned long state;
+};
+
+const int Asset_IndexEntries = (4096 - sizeof(AssetIndexHeader)) / sizeof(AssetEntry);
+
+struct Asset
+{
+	unsigned long address;
+	unsigned long length;
+};
+
+// Flash must be available, and callers keep control requests out while these use the SPI bus.
+int asset_open(unsigned long key, Asset* asset); // Returns 1 if the key was found
+
+#endif
@@ -247,6 +247,7 @@ int_PIO0:
 
 
 @ Setup weak references so C functions can take over these interrupts.
+.weak int_SysTick
 .weak int_I2C0
 .weak int_CT16B0
 .weak int_CT16B1
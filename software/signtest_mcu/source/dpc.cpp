@@ -24,15 +24,15 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 #include "dpc.h"
 #include "winusbserial.h"
 #include "system.h"
+#include "stream.h"
+#include "playback.h"
+#include "framebuffer.h"
+#include "power.h"
 
 unsigned char dpc_suspendcount;
 
 int programcount;
 
-// 1:30 as percentage between 0v and 3.3v
-// Current sense is 0.01 Ohm = 10mV/A, amplified by a factor of 56.55555 (10k, 180ohm resistor values) (565.555mV/A)
-const int current_limit = 1<<29; // 3.3/4 V = 1.45A;
-
 
 void led_set_red(int value);
 void led_set_green(int value);
@@ -53,9 +53,9 @@ void motor_brake_34();
 
 void dpc_work()
 {
-
-
-
+	stream_work();
+	fb_work();
+	power_work();
 }
 
 
@@ -71,6 +71,12 @@ void dpc_tick()
 			update_firmware();
 		}
 	}
+
+	playback_tick();
+	fb_scroll_tick();
+
+	if(!power_reported)
+		dpc_trigger(); // Retry the fault report if the bulk endpoint was full.
 	
 	dpc_resume();
 }
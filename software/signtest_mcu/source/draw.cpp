@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "draw.h"
+#include "framebuffer.h"
+
+void draw_fill_rect(int x, int y, int w, int h, const unsigned char* rgb)
+{
+	if(x + w > fb_canvas_width) w = fb_canvas_width - x;
+	if(y + h > fb_canvas_height) h = fb_canvas_height - y;
+	if(w <= 0 || h <= 0) return;
+
+	if(w == fb_canvas_width)
+	{
+		// Full width rows are one linear run.
+		fb_write_begin(y * fb_canvas_width);
+		fb_write_fill(rgb, w * h);
+		return;
+	}
+
+	for(int row = y; row < y + h; row++)
+	{
+		fb_write_begin(row * fb_canvas_width + x);
+		fb_write_fill(rgb, w);
+	}
+}
+
+void draw_glyph_row(int x, int y, int w, const unsigned char* bits, const unsigned char* fg, const unsigned char* bg)
+{
+	// Draw runs of the same color at once, neighbouring runs still end up in the same SPI burst.
+	int i = 0;
+	while(i < w)
+	{
+		int start = i;
+		int set = (bits[i>>3] >> (7-(i&7))) & 1;
+		while(i < w && ((bits[i>>3] >> (7-(i&7))) & 1) == set)
+			i++;
+
+		const unsigned char* color = set ? fg : bg;
+		if(color)
+			draw_fill_rect(x + start, y, i - start, 1, color);
+	}
+}
@@ -0,0 +1,35 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#ifndef DRAW_H
+#define DRAW_H
+
+// Drawing primitives on the canvas, written straight into the FPGA framebuffer. Everything is clipped to the canvas.
+// Coordinates and sizes come from 16bit stream fields, so they are never negative and only the right and bottom edges clip.
+// Colors are 3 bytes, R,G,B.
+
+void draw_fill_rect(int x, int y, int w, int h, const unsigned char* rgb);
+// Draw one row of a 1bpp glyph, w pixels from bits (MSB first). Set bits are drawn in fg, clear bits in bg (or skipped if bg is 0)
+void draw_glyph_row(int x, int y, int w, const unsigned char* bits, const unsigned char* fg, const unsigned char* bg);
+
+#endif
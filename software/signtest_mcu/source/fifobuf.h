@@ -24,9 +24,11 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 #ifndef FIFOBUF_H
 #define FIFOBUF_H
 
+#include "system.h"
+
 // Generic FIFO buffer implementation
 // Cannot trust global constructors on NXP chip currently (have not hooked them up)
-// Buffer size must be a power of 2 <= 256
+// Buffer size must be a power of 2 (start/end are 16bit)
 
 template<int buffersize>
 class FifoBuffer
@@ -35,6 +37,7 @@ public:
 	volatile unsigned char buffer[buffersize];
 	volatile unsigned short start, end;
 	static const unsigned short buffermask = (unsigned short)(buffersize-1);
+	STATIC_ASSERT((buffersize & (buffersize-1)) == 0 && buffersize <= 32768, buffersize_is_power_of_2);
 	// Start is the next byte to remove from the buffer, and end is the next byte to add to the buffer
 	// So buffer writer controls end, and buffer reader controls end
 	void init()
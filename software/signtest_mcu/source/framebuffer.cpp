@@ -0,0 +1,693 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "lpc13xx.h"
+#include "framebuffer.h"
+#include "system.h"
+#include "io.h"
+#include "dpc.h"
+#include "winusbserial.h"
+
+
+const int FpgaCmd_Write = 0x00; // FPGA SPI command byte to write data, followed by a 16bit big endian address and 24bit pixels.
+const int FpgaCmd_Register = 0x01; // Write registers, each an 8bit register and 16bit big endian value
+const int FpgaCmd_Status = 0x02; // Read the status byte
+
+const int FpgaReg_DisplayPage = 0x00; // Page shown from the next frame, in panels
+const int FpgaReg_ScrollX = 0x01; // Scroll column
+const int FpgaReg_ScrollLast = 0x02; // Width of the scrolled canvas, in panels, minus one
+const int FpgaReg_Brightness = 0x03;
+const int FpgaReg_Planes = 0x04;
+const int FpgaReg_Rows = 0x05;
+const int FpgaReg_Blank = 0x06;
+
+const int Display_DefaultBrightness = 16; // FPGA's power-on values
+const int Display_MaxPlanes = 8;
+const int Display_MaxRows = 16;
+
+const int FpgaStatus_FlipPending = 1;
+const int Fpga_FlipPolls = 20000; // Give up waiting for a flip after this many status reads (~40ms, several frames)
+const int Fpga_FlipFrames = 40; // The same limit for fb_flip_ready, in USB frames
+const int Fb_FlashPixels = 16; // Pixels moved from SPI flash to the FPGA at a time by fb_write_flash
+
+const unsigned long Gamma_Magic = 0x424D4147; // "GAMB", curve and balance (older saves held three tables)
+
+
+// Default correction curve (gamma 2.2)
+const unsigned char gamma_default[256] = {
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+	  1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+	  3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+	  6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+	 12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+	 20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+	 30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+	 42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+	 56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+	 73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+	 91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+	113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+	137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+	163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+	192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+	223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+
+unsigned char gamma_curve[256];
+unsigned char gamma_balance[3];
+int gamma_scale[3]; // Balance as a multiplier, 256 = full
+int gamma_identity;
+
+PanelLayout fb_layout;
+int fb_canvas_width, fb_canvas_height;
+int fb_panel_height;
+
+int fb_burst; // Nonzero while a write burst holds the FPGA selected
+int fb_burst_address; // FPGA address the open burst will write to next
+int fb_cursor; // Linear address of the next pixel to be written
+
+int fb_front_page, fb_back_page;
+int fb_flip_pending; // The old front page may still be on screen, don't draw into it yet
+int fb_flip_frame; // USB frame the pending flip was requested in
+
+struct FrameQueueEntry
+{
+	unsigned char page;
+	unsigned short frame;
+};
+
+FrameQueueEntry fb_queue[FrameQueue_Max];
+int fb_queue_head;
+int fb_queued;
+int fb_frames_late, fb_frames_early;
+int fb_late_max;
+int fb_queue_stalled; // fb_present_at is being retried for the same frame
+int fb_queue_waiting; // Someone is waiting for a page to be freed, or for a flip to finish
+
+ScrollState fb_scroll, fb_scroll_pending;
+int fb_scroll_position; // Scroll column, 24.8 fixed point
+int fb_scroll_sent; // Scroll column the FPGA has, -1 if it needs to be sent
+
+DisplayControl fb_display;
+
+
+void gamma_defaults()
+{
+	memcpy(gamma_curve, gamma_default, 256);
+	for(int c=0;c<3;c++)
+		gamma_balance[c] = 255;
+	gamma_update();
+}
+
+void gamma_update()
+{
+	gamma_identity = 1;
+	for(int c=0;c<3;c++)
+	{
+		gamma_scale[c] = gamma_balance[c] + 1;
+		if(gamma_balance[c] != 255)
+			gamma_identity = 0;
+	}
+	for(int i=0;i<256;i++)
+	{
+		if(gamma_curve[i] != i)
+		{
+			gamma_identity = 0;
+			return;
+		}
+	}
+}
+
+unsigned long gamma_sum(unsigned long sum, const unsigned char* data, int length)
+{
+	for(int i=0;i<length;i++)
+	{
+		sum = (sum<<1 | sum>>31) + data[i];
+	}
+	return sum;
+}
+
+unsigned long gamma_checksum()
+{
+	return gamma_sum(gamma_sum(Gamma_Magic, gamma_curve, 256), gamma_balance, 3);
+}
+
+// The saved curve occupies the first page of Flash_GammaSector, followed by a page with the magic value, checksum and balance.
+struct GammaHeader
+{
+	unsigned long magic;
+	unsigned long checksum;
+	unsigned char balance[4];
+};
+
+int gamma_load()
+{
+	GammaHeader header;
+	fb_flush();
+	SpiEngage();
+	flash_read(Flash_GammaSector + 256, sizeof(header), (unsigned char*)&header);
+	if(header.magic != Gamma_Magic)
+		return 0;
+
+	// Check the saved curve before anything is overwritten, a piece at a time so it doesn't need a second copy.
+	unsigned char buffer[32];
+	unsigned long sum = Gamma_Magic;
+	for(int i=0;i<256;i+=sizeof(buffer))
+	{
+		flash_read(Flash_GammaSector + i, sizeof(buffer), buffer);
+		sum = gamma_sum(sum, buffer, sizeof(buffer));
+	}
+	if(header.checksum != gamma_sum(sum, header.balance, 3))
+		return 0;
+
+	flash_read(Flash_GammaSector, 256, gamma_curve);
+	memcpy(gamma_balance, header.balance, 3);
+	gamma_update();
+	return 1;
+}
+
+int gamma_save()
+{
+	GammaHeader header = { Gamma_Magic, gamma_checksum(), { gamma_balance[0], gamma_balance[1], gamma_balance[2], 0xFF } };
+	fb_flush();
+	SpiEngage();
+	flash_erase_sector(Flash_GammaSector);
+	if(!flash_waitbusy()) return 0;
+	flash_program(Flash_GammaSector, 256, gamma_curve);
+	if(!flash_waitbusy()) return 0;
+	flash_program(Flash_GammaSector + 256, sizeof(header), (unsigned char*)&header);
+	return flash_waitbusy();
+}
+
+
+
+void fb_init()
+{
+	fb_burst = 0;
+	fb_cursor = 0;
+	fb_front_page = fb_back_page = 0;
+	fb_flip_pending = 0;
+	fb_flip_frame = 0;
+	fb_queue_head = fb_queued = 0;
+	fb_frames_late = fb_frames_early = fb_late_max = 0;
+	fb_queue_stalled = fb_queue_waiting = 0;
+	fb_scroll.x = 0;
+	fb_scroll.rate = 0;
+	fb_scroll_position = 0;
+	fb_scroll_sent = 0;
+	fb_display_defaults();
+	fb_layout.count = 1;
+	fb_layout.columns = 1;
+	fb_layout.flags = 0;
+	fb_layout.rotation = 0;
+	fb_layout_update();
+	gamma_defaults();
+}
+
+void fb_layout_update()
+{
+	fb_flush();
+
+	// Fall back to a single panel if the layout doesn't make sense.
+	if(fb_layout.count == 0 || fb_layout.count > Panel_Max || fb_layout.columns == 0 || fb_layout.columns > fb_layout.count || fb_layout.rotation > 3)
+	{
+		fb_layout.count = 1;
+		fb_layout.columns = 1;
+		fb_layout.flags = 0;
+		fb_layout.rotation = 0;
+	}
+	fb_panel_height = (fb_layout.flags & PanelFlag_HalfHeight) ? 16 : 32;
+	if(fb_panel_height != 32)
+		fb_layout.rotation &= 2; // Only square panels can be turned sideways.
+
+	fb_canvas_width = fb_layout.columns * 32;
+	fb_canvas_height = ((fb_layout.count + fb_layout.columns - 1) / fb_layout.columns) * fb_panel_height;
+
+	// Page size changes with the panel count.
+	if(fb_front_page || fb_back_page || fb_queued)
+		fb_single_buffer();
+
+	// So does the scroll wrap point. Left alone if scrolling was never used, the FPGA may not be running yet.
+	if(fb_scroll_position || fb_scroll.rate)
+	{
+		fb_scroll_position %= fb_canvas_width << 8;
+		fb_scroll.x = fb_scroll_position >> 8;
+		fb_scroll_sent = -1;
+		dpc_trigger();
+	}
+}
+
+void fb_set_register(int reg, int value)
+{
+	fb_flush();
+	SpiEngage();
+	fpga_csenable(1);
+	SpiWriteByte(FpgaCmd_Register);
+	SpiWriteByte(reg);
+	SpiWriteByte((value>>8)&0xFF);
+	SpiWriteByte(value&0xFF);
+	SpiWriteComplete();
+	fpga_csenable(0);
+}
+
+void fb_set_page(int page)
+{
+	fb_set_register(FpgaReg_DisplayPage, page);
+}
+
+// Returns 1 once the FPGA has switched to the last page it was given.
+int fb_flip_done()
+{
+	if(!fb_flip_pending) return 1;
+
+	fb_flush();
+	SpiEngage();
+	fpga_csenable(1);
+	SpiByte(FpgaCmd_Status);
+	int status = SpiByte(0);
+	fpga_csenable(0);
+	if(status & FpgaStatus_FlipPending)
+		return 0;
+
+	fb_flip_pending = 0;
+	return 1;
+}
+
+// Wait until the FPGA has switched pages, so the previous front page can be drawn into.
+void fb_wait_flip()
+{
+	for(int i=0;i<Fpga_FlipPolls;i++)
+	{
+		if(fb_flip_done())
+			return;
+	}
+	fb_flip_pending = 0;
+}
+
+int fb_flip_ready()
+{
+	if(fb_flip_done())
+		return 1;
+	if(((usb_frame - fb_flip_frame) & 0x7FF) >= Fpga_FlipFrames)
+	{
+		fb_flip_pending = 0; // Same as fb_wait_flip giving up
+		return 1;
+	}
+	fb_queue_waiting = 1; // Have the SOF run the DPC again
+	return 0;
+}
+
+void fb_show_page(int page)
+{
+	fb_set_page(page);
+	fb_front_page = page;
+	fb_flip_pending = 1;
+	fb_flip_frame = usb_frame;
+}
+
+// Find a page that is not on screen, queued, or the one given. Returns -1 if there is none.
+int fb_free_page(int exclude)
+{
+	for(int page=0; page + fb_layout.count <= Panel_Max; page += fb_layout.count)
+	{
+		if(page == fb_front_page || page == exclude)
+			continue;
+		int used = 0;
+		for(int i=0;i<fb_queued;i++)
+		{
+			if(fb_queue[(fb_queue_head + i) % FrameQueue_Max].page == page)
+				used = 1;
+		}
+		if(!used)
+			return page;
+	}
+	return -1;
+}
+
+int fb_present()
+{
+	if(fb_layout.count * 2 > Panel_Max)
+		return 0;
+
+	fb_queued = 0;
+	fb_wait_flip(); // Only one flip in flight at a time.
+	fb_show_page(fb_back_page);
+	fb_back_page = fb_free_page(fb_front_page);
+	return 1;
+}
+
+int fb_present_at(int frame)
+{
+	int next = -1;
+	if(fb_layout.count * 2 <= Panel_Max)
+		next = fb_free_page(fb_back_page);
+
+	if(next == -1)
+	{
+		if(fb_layout.count * 2 > Panel_Max)
+		{
+			// No pages to queue in. Hold the caller until the frame instead, so what it draws next lands on time.
+			if(((frame - usb_frame) & 0x7FF) == 0 || ((frame - usb_frame) & 0x7FF) >= 0x400)
+			{
+				fb_queue_stalled = 0;
+				return 1;
+			}
+		}
+		else if(!fb_queue_stalled)
+		{
+			fb_frames_early++;
+		}
+		fb_queue_stalled = 1;
+		fb_queue_waiting = 1;
+		return 0;
+	}
+
+	fb_flush();
+	FrameQueueEntry* entry = &fb_queue[(fb_queue_head + fb_queued) % FrameQueue_Max];
+	entry->page = fb_back_page;
+	entry->frame = frame & 0x7FF;
+	fb_queued++;
+	fb_back_page = next;
+	fb_queue_stalled = 0;
+	return 1;
+}
+
+void fb_sof(int frame)
+{
+	if(fb_queued)
+	{
+		FrameQueueEntry* entry = &fb_queue[fb_queue_head];
+		int wait = (entry->frame - frame) & 0x7FF;
+		// Show it once it's due, or right away if it already missed its frame.
+		// If the FPGA hasn't finished the previous flip yet, it slips to the next SOF (and is late).
+		if((wait == 0 || wait >= 0x400) && fb_flip_done())
+		{
+			if(wait)
+			{
+				fb_frames_late++;
+				if(0x800 - wait > fb_late_max)
+					fb_late_max = 0x800 - wait;
+			}
+			fb_show_page(entry->page);
+			fb_queue_head = (fb_queue_head + 1) % FrameQueue_Max;
+			fb_queued--;
+		}
+	}
+
+	if(fb_queue_waiting)
+	{
+		fb_queue_waiting = 0;
+		dpc_trigger();
+	}
+}
+
+void fb_single_buffer()
+{
+	fb_queued = 0;
+	fb_set_page(0);
+	fb_front_page = fb_back_page = 0;
+	fb_flip_pending = 0; // Drawing is visible from here on either way.
+}
+
+void fb_display_defaults()
+{
+	fb_display.brightness = Display_DefaultBrightness;
+	fb_display.planes = Display_MaxPlanes;
+	fb_display.rows = Display_MaxRows;
+	fb_display.blank = 0;
+}
+
+void fb_display_update()
+{
+	if(fb_display.planes == 0 || fb_display.planes > Display_MaxPlanes)
+		fb_display.planes = Display_MaxPlanes;
+	if(fb_display.rows == 0 || fb_display.rows > Display_MaxRows)
+		fb_display.rows = Display_MaxRows;
+
+	fb_set_register(FpgaReg_Brightness, fb_display.brightness);
+	fb_set_register(FpgaReg_Planes, fb_display.planes);
+	fb_set_register(FpgaReg_Rows, fb_display.rows);
+	fb_set_register(FpgaReg_Blank, fb_display.blank ? 1 : 0);
+}
+
+void fb_fpga_reset()
+{
+	fb_display_defaults();
+	fb_front_page = fb_back_page = 0;
+	fb_flip_pending = 0;
+	fb_queued = 0;
+	fb_scroll.x = 0;
+	fb_scroll.rate = 0;
+	fb_scroll_position = 0;
+	fb_scroll_sent = 0;
+}
+
+void fb_scroll_send()
+{
+	int x = fb_scroll_position >> 8;
+	fb_set_register(FpgaReg_ScrollLast, fb_layout.columns - 1);
+	fb_set_register(FpgaReg_ScrollX, x);
+	fb_scroll_sent = x;
+}
+
+void fb_scroll_set(int x)
+{
+	fb_scroll_position = (x % fb_canvas_width) << 8;
+	fb_scroll.x = fb_scroll_position >> 8;
+	fb_scroll_send();
+}
+
+void fb_scroll_update()
+{
+	fb_scroll = fb_scroll_pending;
+	fb_scroll_position = (fb_scroll.x % fb_canvas_width) << 8;
+	fb_scroll.x = fb_scroll_position >> 8;
+	fb_scroll_sent = -1;
+	dpc_trigger();
+}
+
+void fb_scroll_tick()
+{
+	if(fb_scroll.rate == 0)
+		return;
+
+	int width = fb_canvas_width << 8;
+	fb_scroll_position = (fb_scroll_position + fb_scroll.rate) % width;
+	if(fb_scroll_position < 0)
+		fb_scroll_position += width;
+	fb_scroll.x = fb_scroll_position >> 8;
+
+	if(fb_scroll.x != fb_scroll_sent)
+	{
+		fb_scroll_sent = -1;
+		dpc_trigger();
+	}
+}
+
+void fb_work()
+{
+	if(fb_scroll_sent != -1)
+		return;
+
+	// Control requests may also use the SPI bus.
+	InterruptDisable(INT_USBIRQ);
+	fb_scroll_send();
+	InterruptEnable(INT_USBIRQ);
+}
+
+// Translate a linear canvas address into an FPGA framebuffer address, on the page starting at the given panel.
+// Each panel in the chain owns a Panel_Words region of the FPGA memory. The FPGA scans the top and bottom
+// halves of a panel together, so the bottom half rows live 1024 words above the top half rows.
+// Returns -1 if there is no panel at that address. run is set to the number of pixels, starting at address,
+// that map to consecutive FPGA addresses (decreasing ones if reverse is set)
+int fb_map_address(int page, int address, int* run, int* reverse)
+{
+	int x = address % fb_canvas_width;
+	int y = address / fb_canvas_width;
+	int px = x & 31;
+
+	*run = 32 - px;
+	*reverse = 0;
+	if(y >= fb_canvas_height)
+	{
+		*run = 0x10000; // Nothing more to write.
+		return -1;
+	}
+
+	int row = y / fb_panel_height;
+	int col = x >> 5;
+	int py = y - row * fb_panel_height;
+	int rotation = fb_layout.rotation;
+	if((fb_layout.flags & PanelFlag_Serpentine) && (row & 1))
+	{
+		// Chain runs back along odd rows, with the panels upside down.
+		col = fb_layout.columns - 1 - col;
+		rotation ^= 2;
+	}
+	int panel = row * fb_layout.columns + col;
+	if(panel >= fb_layout.count)
+		return -1;
+
+	int lx, ly;
+	switch(rotation)
+	{
+	default:
+		lx = px; ly = py;
+		break;
+	case 1: // 90 degrees clockwise
+		lx = py; ly = 31 - px;
+		*run = 1;
+		break;
+	case 2: // 180 degrees
+		lx = 31 - px; ly = fb_panel_height - 1 - py;
+		*reverse = 1;
+		break;
+	case 3: // 270 degrees
+		lx = 31 - py; ly = px;
+		*run = 1;
+		break;
+	}
+
+	int half = fb_panel_height / 2;
+	if(ly >= half)
+		ly += 32 - half; // Bottom half starts at word 1024 within the panel.
+	return (page + panel) * Panel_Words + ly * 32 + lx;
+}
+
+// Select the FPGA for writing at an address, continuing the open burst if it is already there.
+void fb_select(int fpga_address)
+{
+	if(fb_burst)
+	{
+		if(fpga_address == fb_burst_address)
+			return;
+		fb_flush();
+	}
+
+	fb_wait_flip();
+	SpiEngage();
+	fpga_csenable(1);
+	SpiWriteByte(FpgaCmd_Write);
+	SpiWriteByte((fpga_address>>8)&0xFF);
+	SpiWriteByte(fpga_address&0xFF);
+	fb_burst = 1;
+	fb_burst_address = fpga_address;
+}
+
+void fb_flush()
+{
+	if(!fb_burst) return;
+	SpiWriteComplete();
+	fpga_csenable(0);
+	fb_burst = 0;
+}
+
+void fb_write_begin(int address)
+{
+	fb_cursor = address;
+}
+
+// Step is 3 to send pixels in order, -3 to send them backwards starting from the last one, or 0 to repeat one pixel.
+void fb_write_run(const unsigned char* rgb, int count, int step)
+{
+	if(gamma_identity)
+	{
+		// Fast path, tables would not change anything.
+		while(count--)
+		{
+			SpiWriteByte(rgb[0]);
+			SpiWriteByte(rgb[1]);
+			SpiWriteByte(rgb[2]);
+			rgb += step;
+		}
+	}
+	else
+	{
+		while(count--)
+		{
+			SpiWriteByte((gamma_curve[rgb[0]] * gamma_scale[0]) >> 8);
+			SpiWriteByte((gamma_curve[rgb[1]] * gamma_scale[1]) >> 8);
+			SpiWriteByte((gamma_curve[rgb[2]] * gamma_scale[2]) >> 8);
+			rgb += step;
+		}
+	}
+}
+
+void fb_write(const unsigned char* rgb, int count, int step)
+{
+	while(count > 0)
+	{
+		int run, reverse;
+		int fpga_address = fb_map_address(fb_back_page, fb_cursor, &run, &reverse);
+		if(run > count) run = count;
+
+		if(fpga_address != -1)
+		{
+			if(reverse)
+			{
+				fb_select(fpga_address - run + 1);
+				fb_write_run(rgb + (run-1)*step, run, -step);
+			}
+			else
+			{
+				fb_select(fpga_address);
+				fb_write_run(rgb, run, step);
+			}
+			fb_burst_address += run;
+		}
+
+		fb_cursor += run;
+		rgb += run*step;
+		count -= run;
+	}
+}
+
+void fb_write_rgb(const unsigned char* rgb, int count)
+{
+	fb_write(rgb, count, 3);
+}
+
+void fb_write_fill(const unsigned char* rgb, int count)
+{
+	fb_write(rgb, count, 0);
+}
+
+void fb_write_flash(int address, int count)
+{
+	unsigned char buffer[Fb_FlashPixels*3];
+	while(count > 0)
+	{
+		int chunk = count;
+		if(chunk > Fb_FlashPixels) chunk = Fb_FlashPixels;
+
+		// Flash and FPGA share the bus, so the burst is closed for each read and picks up where it left off.
+		fb_flush();
+		SpiEngage();
+		flash_read(address, chunk*3, buffer);
+		fb_write_rgb(buffer, chunk);
+
+		address += chunk*3;
+		count -= chunk;
+	}
+}
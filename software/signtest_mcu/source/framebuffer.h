@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+// Writing pixel data into the FPGA framebuffer, with color correction applied on the way through.
+
+// Gamma / color correction, applied to every pixel written through fb_write_rgb. One 256-entry curve is shared by the
+// three channels, and each channel's result is then scaled by its balance (255 = full), to correct the panel's white point.
+extern unsigned char gamma_curve[256];
+extern unsigned char gamma_balance[3]; // R, G, B
+extern int gamma_identity; // Nonzero when the curve is identity and the balance full, in which case the lookup is skipped entirely.
+
+void gamma_defaults(); // Restore the compile-time default curve and full balance
+void gamma_update(); // Call after modifying gamma_curve or gamma_balance, to recompute the identity fast path
+int gamma_load(); // Load the curve and balance from SPI flash, returns 1 on success (tables are left unchanged on failure)
+int gamma_save(); // Save the curve and balance to SPI flash, returns 1 on success
+
+// Panel layout. Panels are numbered in the order they are chained, and are arranged on the canvas left to right,
+// top to bottom in rows of 'columns' panels. Each panel has a Panel_Words region in the FPGA framebuffer.
+const int Panel_Max = 8;
+const int Panel_Words = 2048;
+
+const int PanelFlag_Serpentine = 1; // Chain runs right to left on odd rows, with those panels mounted upside down
+const int PanelFlag_HalfHeight = 2; // 32x16 panels (default is 32x32)
+
+struct PanelLayout
+{
+	unsigned char count; // Number of panels in the chain, 1 to Panel_Max
+	unsigned char columns; // Panels across the canvas
+	unsigned char flags; // PanelFlag_*
+	unsigned char rotation; // Orientation of the panels, in units of 90 degrees clockwise. Sideways only for 32x32 panels.
+};
+
+extern PanelLayout fb_layout;
+extern int fb_canvas_width, fb_canvas_height;
+void fb_layout_update(); // Call after modifying fb_layout. Invalid layouts revert to a single panel.
+
+// Pixel addresses are linear canvas addresses (y*fb_canvas_width+x), and are translated to the FPGA's layout here.
+// Addresses that don't land on a panel are dropped.
+// Writes are merged into a single burst for as long as they stay contiguous in the FPGA, so the FPGA
+// stays selected after a write completes. fb_flush must be called before anything else uses the SPI bus.
+void fb_init();
+void fb_write_begin(int address); // Set the linear address of the next pixel to write
+void fb_write_rgb(const unsigned char* rgb, int count); // Write count pixels (3 bytes each, R,G,B) through the gamma tables
+void fb_write_fill(const unsigned char* rgb, int count); // Write one pixel (R,G,B) count times
+void fb_write_flash(int address, int count); // Write count pixels (R,G,B) read from SPI flash at address, through the gamma tables
+void fb_flush(); // End the open burst, if any
+
+// Page flipping. The FPGA displays one page of fb_layout.count panel regions, and switches pages at the end of a frame.
+// Until the first fb_present, writes go straight to the displayed page. After it, writes go to the hidden back page
+// and each fb_present shows what was drawn since the previous one. This needs room for two pages (count <= Panel_Max/2).
+extern int fb_front_page, fb_back_page; // Page base, in panels
+int fb_present(); // Returns 0 if the layout is too large to double buffer (writes stay visible). Drops queued frames.
+void fb_single_buffer(); // Display and draw page 0 again
+// Drawing and fb_present wait (up to ~40ms) for the previous flip to finish. Code that runs with the USB IRQ disabled checks
+// fb_flip_ready first instead: it returns 0 while the flip is still in progress, and has the next SOF trigger the DPC to try again.
+int fb_flip_ready();
+
+// Frame queue. Every page the FPGA memory has room for beyond the front and back pages can hold a finished frame,
+// waiting to be shown when the USB SOF frame number reaches its target. Targets are 11 bit frame numbers and must be
+// less than a second ahead; anything further is taken as already missed.
+// Queue calls must be made with the USB IRQ disabled, the queue is drained from the SOF interrupt.
+const int FrameQueue_Max = Panel_Max - 2;
+
+extern int fb_queued; // Frames waiting in the queue
+extern int fb_frames_late; // Frames shown after their target frame
+extern int fb_late_max; // Most frames any of them was late by
+extern int fb_frames_early; // Frames that arrived while the queue was full, and had to wait to be queued
+int fb_present_at(int frame); // Queue the back page for frame. Returns 0 if there is no room yet (try again later).
+void fb_sof(int frame); // Called on every USB SOF
+
+// Hardware scrolling. The panel shows a window into the first row of the canvas, starting at the scroll column
+// and wrapping around at the canvas width. Columns can be drawn off screen before they are scrolled into view,
+// so a ticker only has to send the newly revealed columns. Changes take effect at the next FPGA frame.
+struct ScrollState
+{
+	unsigned short x; // Scroll column
+	short rate; // Auto-scroll speed in pixels per tick, 8.8 fixed point. Negative scrolls right, 0 = off
+};
+
+const int Scroll_TickMs = 10; // Rate fb_scroll_tick is called at
+
+extern ScrollState fb_scroll; // Current state
+extern ScrollState fb_scroll_pending; // Written by the host, applied by fb_scroll_update
+void fb_scroll_set(int x); // Set the scroll column now (from the stream), auto-scroll continues from there
+void fb_scroll_update(); // Apply fb_scroll_pending, the change is sent to the FPGA from the DPC
+void fb_scroll_tick(); // Advance auto-scroll, called on every timer tick
+void fb_work(); // Send pending display changes to the FPGA, called from the DPC
+
+// Display control, applied by the FPGA's scan. Brightness is the on-time of the least significant bit plane, so raising it
+// also lowers the refresh rate. Showing fewer bit planes drops the least significant ones, trading color depth for refresh rate.
+struct DisplayControl
+{
+	unsigned char brightness; // 0-255, default 16
+	unsigned char planes; // Bit planes, 1-8
+	unsigned char rows; // Scan rows per panel half, 1-16 (8 for 1/8 scan panels)
+	unsigned char blank; // Nonzero turns the LEDs off
+};
+
+extern DisplayControl fb_display;
+void fb_display_defaults(); // Reset fb_display to the FPGA's power-on values, without sending them
+void fb_display_update(); // Call after modifying fb_display. Invalid plane and row counts revert to their defaults.
+
+void fb_fpga_reset(); // The FPGA was reconfigured, its display registers are back to their defaults
+
+#endif
@@ -41,6 +41,10 @@ extern int adc_last[3]; // 2:14 raw ADC values: VIN, 3v3, 1v2 sense lines.
 
 void SpiRelease(); // Stop holding Flash pins shared with FPGA
 void SpiEngage(); // Take control of flash pins
+void SpiWriteByte(int byte); // Transmit only, does not wait for the byte to complete.
+void SpiWriteComplete(); // Wait for all bytes from SpiWriteByte to complete.
+int SpiByte(int byte); // Exchange one byte
+void SpiData(unsigned char * dataIn, unsigned char * dataOut, int length); // Either buffer may be 0 (receive discarded / send zeros)
 
 
 const int Flash_SectorSize = 4096;
@@ -50,7 +54,11 @@ const int Flash_ID = 0x014015; // Spansion S25FL116k.
 // Using other parts is possible but the software provides an overridable lockout because sector sizes or commands may change. Todo: SFDP
 //const int Flash_ID = 0xC22013; // A flash part from another project compatible with this implementation.
 
+const int Flash_GammaSector = 0x1FF000; // Last sector of the flash holds saved gamma tables
+// 0x080000-0x1FEFFF holds the asset store, see asset.h
 
+
+void flash_csenable(int enable);
 int flash_RDID();
 int flash_status();
 int flash_waitbusy(); // returns 1 on success, 0 on timeout
@@ -61,6 +69,7 @@ void flash_program(int address, int length, unsigned char* data);
 void flash_spiexchange(unsigned char * dataSwap, int length);
 
 void fpga_prog(int halt); // 1 = stop FPGA, 0 = run FPGA
+void fpga_csenable(int enable);
 void fpga_spiexchange(unsigned char * dataSwap, int length);
 int fpga_waitboot(); // Returns 1 on success.
 
@@ -107,6 +107,14 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 // Neglecting to define all IPRx regs, since the array exists
 #define STIR NVIC_REG(0xF00)
 
+// SysTick and system handler priorities (Cortex-M3 core)
+#define SYST_CSR NVIC_REG(0x010)
+#define SYST_RVR NVIC_REG(0x014)
+#define SYST_CVR NVIC_REG(0x018)
+#define SYST_CALIB NVIC_REG(0x01C)
+#define ICSR NVIC_REG(0xD04)
+#define SHPR3 NVIC_REG(0xD20)
+
 // Interrupt definitions - neglecting PIO registers for start enable.
 #define INT_I2C0 40
 #define INT_CT16B0 41
@@ -279,6 +287,23 @@ static inline void InterruptSetPriority(int InterruptSource, int Priority)
 #define GPIO3MIS GPIOnMIS(3)
 #define GPIO3IC GPIOnIC(3)
 
+// A direction change is a read-modify-write of the whole port. The ADC interrupt turns the power drive pins off at any
+// time (see power.cpp), so these keep interrupts out for the few cycles it takes and never write back a stale value.
+static inline void GpioDirSet(int port, unsigned long mask)
+{
+	unsigned long primask;
+	asm volatile("mrs %0, primask\n\tcpsid i" : "=r"(primask) : : "memory");
+	GPIOnDIR(port) |= mask;
+	asm volatile("msr primask, %0" : : "r"(primask) : "memory");
+}
+static inline void GpioDirClear(int port, unsigned long mask)
+{
+	unsigned long primask;
+	asm volatile("mrs %0, primask\n\tcpsid i" : "=r"(primask) : : "memory");
+	GPIOnDIR(port) &= ~mask;
+	asm volatile("msr primask, %0" : : "r"(primask) : "memory");
+}
+
 
 
 
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#include "lpc13xx.h"
+#include "lz.h"
+#include "framebuffer.h"
+#include "io.h"
+
+const int Lz_StreamPixels = 16; // Pixels decoded before they are written to the FPGA
+
+
+void lz_begin(LzDecoder* lz, int address, int length, unsigned char* window)
+{
+	lz->address = address;
+	lz->remaining = length;
+	lz->input_position = Lz_InputBlock; // Read the first block when it's needed
+	lz->literal = 0;
+	lz->run = 0;
+	lz->distance = 1;
+	lz->position = 0;
+	lz->window = window;
+	for(int i=0;i<Lz_WindowSize;i++)
+		window[i] = 0;
+}
+
+// Returns -1 past the end of the compressed data.
+int lz_input(LzDecoder* lz)
+{
+	if(lz->remaining <= 0)
+		return -1;
+	lz->remaining--;
+	if(lz->input_position == Lz_InputBlock)
+	{
+		// Flash and FPGA share the SPI bus.
+		fb_flush();
+		SpiEngage();
+		flash_read(lz->address, Lz_InputBlock, lz->input);
+		lz->address += Lz_InputBlock;
+		lz->input_position = 0;
+	}
+	return lz->input[lz->input_position++];
+}
+
+int lz_read(LzDecoder* lz, unsigned char* data, int length)
+{
+	for(int i=0;i<length;i++)
+	{
+		if(lz->run == 0)
+		{
+			int token = lz_input(lz);
+			if(token == -1)
+				return i;
+			if(token & 0x80)
+			{
+				int distance = lz_input(lz);
+				if(distance == -1)
+					return i;
+				distance++;
+				if(distance > Lz_WindowSize)
+				{
+					lz->remaining = 0; // Not valid data, end here
+					return i;
+				}
+				lz->literal = 0;
+				lz->run = (token & 0x7F) + Lz_MinMatch;
+				lz->distance = distance;
+			}
+			else
+			{
+				lz->literal = 1;
+				lz->run = token + 1;
+			}
+		}
+
+		int c;
+		if(lz->literal)
+		{
+			c = lz_input(lz);
+			if(c == -1)
+				return i;
+		}
+		else
+		{
+			int from = lz->position - lz->distance;
+			if(from < 0) from += Lz_WindowSize;
+			c = lz->window[from];
+		}
+		lz->run--;
+
+		lz->window[lz->position] = c;
+		lz->position = (lz->position == Lz_WindowSize - 1) ? 0 : lz->position + 1;
+		data[i] = c;
+	}
+	return length;
+}
+
+int lz_stream(LzDecoder* lz, int count)
+{
+	unsigned char buffer[Lz_StreamPixels*3];
+	int written = 0;
+	while(written < count)
+	{
+		int chunk = count - written;
+		if(chunk > Lz_StreamPixels) chunk = Lz_StreamPixels;
+
+		int decoded = lz_read(lz, buffer, chunk*3) / 3;
+		fb_write_rgb(buffer, decoded);
+		written += decoded;
+		if(decoded < chunk)
+			break;
+	}
+	return written;
+}
@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+// Streaming LZ decoder, for compressed pixel data in flash.
+// Compressed data is a series of tokens:
+//   0x00-0x7F: token+1 literal bytes follow.
+//   0x80-0xFF: copy (token&0x7F)+Lz_MinMatch bytes from the window, starting (next byte)+1 bytes back. Copies may overlap
+//              what they produce, so a run of one color is a single copy from 3 bytes back.
+// The window starts out zeroed, so the compressor may copy black from before the start of the data.
+// The distance byte can encode up to 256, but the window only holds Lz_WindowSize bytes, so the encoder never emits a
+// distance over Lz_WindowSize. A larger one marks the data as invalid and ends the decode there.
+// There is no end marker, the caller knows how much data to decode. Decoding also ends where the compressed data does.
+
+const int Lz_WindowSize = 224; // Copies reach at most this far back
+const int Lz_MinMatch = 3;
+const int Lz_MaxMatch = 0x7F + Lz_MinMatch;
+const int Lz_InputBlock = 32; // Compressed bytes read from flash at a time
+
+struct LzDecoder
+{
+	int address; // Flash address of the next input block
+	int remaining; // Compressed bytes left to read
+	unsigned char input[Lz_InputBlock];
+	unsigned char input_position;
+	unsigned char literal; // The current run is literals rather than a copy
+	unsigned char run; // Bytes left in the current run
+	unsigned char distance; // Copy distance
+	unsigned char position; // Next window byte to write
+	unsigned char* window; // Lz_WindowSize bytes, owned by the caller
+};
+
+void lz_begin(LzDecoder* lz, int address, int length, unsigned char* window); // length = compressed bytes at address
+int lz_read(LzDecoder* lz, unsigned char* data, int length); // Returns bytes decoded, less than length once the data has ended
+// Decode count pixels (R,G,B) into the framebuffer, continuing from the last address written (see fb_write_begin).
+// Returns pixels written, less than count once the data has ended.
+int lz_stream(LzDecoder* lz, int count);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "lpc13xx.h"
+#include "playback.h"
+#include "framebuffer.h"
+#include "io.h"
+#include "arena.h"
+#include "lz.h"
+#include "stream.h"
+
+const int Playback_TickMs = 10; // Rate playback_tick is called at
+
+int play_mode;
+int play_frame;
+int play_direction;
+int play_ticks; // Ticks left to display the current frame
+
+int play_address;
+int play_frames;
+int play_pixels;
+int play_length;
+
+
+void playback_init()
+{
+	play_mode = PlayMode_Stop;
+	play_frame = 0;
+}
+
+int playback_start(int address, int mode)
+{
+	AnimHeader header;
+
+	fb_flush();
+	SpiEngage();
+	flash_read(address, sizeof(header), (unsigned char*)&header);
+	if(header.magic != Anim_Magic || header.frames == 0 || mode < PlayMode_Once || mode > PlayMode_PingPong)
+		return 0;
+	if(header.pixels == 0 || header.pixels > (unsigned long)(fb_layout.count * Panel_Words))
+		return 0;
+	if(address >= Flash_GammaSector || header.length > (unsigned long)(Flash_GammaSector - address) || header.length < sizeof(header) + header.frames * sizeof(AnimFrame))
+		return 0;
+
+	arena_claim(Arena_Display);
+	stream_stop_lz(); // Its decoder window is about to be reused
+	play_address = address;
+	play_frames = header.frames;
+	play_pixels = header.pixels;
+	play_length = header.length;
+	play_frame = 0;
+	play_direction = 1;
+	play_ticks = 0;
+	play_mode = mode;
+	return 1;
+}
+
+void playback_stop()
+{
+	play_mode = PlayMode_Stop;
+}
+
+// Copy a frame from flash to the FPGA, returns the frame duration in ticks.
+int playback_show(int frame)
+{
+	AnimFrame entry;
+	LzDecoder lz;
+
+	// Control requests may also use the SPI bus, keep them out while moving each chunk.
+	InterruptDisable(INT_USBIRQ);
+	fb_flush();
+	SpiEngage();
+	flash_read(play_address + sizeof(AnimHeader) + frame * sizeof(AnimFrame), sizeof(entry), (unsigned char*)&entry);
+	InterruptEnable(INT_USBIRQ);
+
+	// Frame data must lie inside the container, after the index. Stop rather than show whatever the offset points at.
+	unsigned long start = sizeof(AnimHeader) + play_frames * sizeof(AnimFrame);
+	unsigned long size = (entry.flags & AnimFrameFlag_Lz) ? 1 : play_pixels * 3;
+	if(entry.offset < start || entry.offset >= (unsigned long)play_length || size > play_length - entry.offset)
+	{
+		play_mode = PlayMode_Stop;
+		return 1;
+	}
+
+	int address = play_address + entry.offset;
+	int remaining = play_pixels;
+	fb_write_begin(0);
+	while(remaining > 0)
+	{
+		int count = remaining;
+		if(count > Playback_ChunkPixels) count = Playback_ChunkPixels;
+
+		InterruptDisable(INT_USBIRQ);
+		if(play_mode == PlayMode_Stop)
+		{
+			// Stopped by a control request, the LZ window may belong to someone else now.
+			InterruptEnable(INT_USBIRQ);
+			break;
+		}
+		if(entry.flags & AnimFrameFlag_Lz)
+		{
+			if(remaining == play_pixels)
+				lz_begin(&lz, address, play_length - entry.offset, arena.display.lz_window); // At most to the end of the container
+			if(lz_stream(&lz, count) < count)
+				remaining = count; // The frame's data ended early, leave the rest as it was
+		}
+		else
+		{
+			fb_write_flash(address, count);
+			address += count*3;
+		}
+		InterruptEnable(INT_USBIRQ);
+
+		remaining -= count;
+	}
+
+	// Show the frame once it is complete, so it never tears. Without room for a second page it was drawn in place.
+	InterruptDisable(INT_USBIRQ);
+	if(play_mode != PlayMode_Stop)
+		fb_present();
+	InterruptEnable(INT_USBIRQ);
+
+	int ticks = entry.duration / Playback_TickMs;
+	return ticks ? ticks : 1;
+}
+
+void playback_tick()
+{
+	if(play_mode == PlayMode_Stop)
+		return;
+
+	if(play_ticks > 0)
+	{
+		play_ticks--;
+		if(play_ticks > 0)
+			return;
+	}
+
+	play_ticks = playback_show(play_frame);
+
+	// Pick the next frame
+	if(play_mode == PlayMode_PingPong)
+	{
+		if(play_frame + play_direction < 0 || play_frame + play_direction >= play_frames)
+			play_direction = -play_direction;
+		if(play_frames > 1)
+			play_frame += play_direction;
+	}
+	else
+	{
+		play_frame++;
+		if(play_frame >= play_frames)
+		{
+			play_frame = 0;
+			if(play_mode == PlayMode_Once)
+				play_mode = PlayMode_Stop;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+// Standalone animation playback from SPI flash.
+// An animation container starts on a 64k flash block:
+//   AnimHeader, then AnimFrame index entries for each frame, then frame data.
+//   Each frame is a full canvas of linear R,G,B pixel data (header.pixels*3 bytes) at the offset given by its index entry,
+//   LZ compressed if the entry says so (see lz.h).
+// Containers and frames that don't fit in header.length, or frames larger than the canvas, are not played.
+
+const unsigned long Anim_Magic = 0x4D494E41; // "ANIM"
+
+struct AnimHeader
+{
+	unsigned long magic;
+	unsigned short frames;
+	unsigned short reserved;
+	unsigned long pixels; // Pixels in each frame
+	unsigned long length; // Bytes in the container, including this header
+};
+
+struct AnimFrame
+{
+	unsigned long offset; // Frame data location, relative to the start of the container
+	unsigned short duration; // Time to display the frame, in ms
+	unsigned short flags; // AnimFrameFlag_*
+};
+
+const int AnimFrameFlag_Lz = 1;
+
+const int Playback_ChunkPixels = 64; // Pixels moved from flash to the FPGA at a time
+
+const int PlayMode_Stop = 0;
+const int PlayMode_Once = 1; // Play through once, leave the last frame displayed
+const int PlayMode_Loop = 2;
+const int PlayMode_PingPong = 3; // Play forward then backward, repeatedly
+
+extern int play_mode;
+extern int play_frame;
+
+void playback_init();
+int playback_start(int address, int mode); // Returns 1 if a valid container was found at address
+void playback_stop();
+void playback_tick(); // Called on every timer tick
+
+#endif
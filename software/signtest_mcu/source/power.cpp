@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "lpc13xx.h"
+#include "power.h"
+#include "winusbserial.h"
+#include "dpc.h"
+#include "io.h"
+#include "adc.h"
+
+PowerLimits power_limits;
+volatile int power_fault;
+int power_fault_value;
+int power_trips; // Number of faults since boot
+volatile int power_blank; // Ticks left before rails are checked
+int power_reported; // The latched fault has been sent to the host (or cleared)
+
+int power_out[3]; // Comparator state for each rail: 0 = good, otherwise the fault code it would trip with
+int power_count[3]; // Consecutive scans the rail has been out of limits
+int power_filter_scans; // power_limits.filter at the current ADC rate
+
+
+void power_init()
+{
+	// VIN 4.0V - 5.8V, 3V3 3.0V - 3.6V, 1V2 1.0V - 1.4V
+	power_limits.low[0] = 6619;
+	power_limits.high[0] = 9598;
+	power_limits.low[1] = 7447;
+	power_limits.high[1] = 8936;
+	power_limits.low[2] = 2482;
+	power_limits.high[2] = 3475;
+	power_limits.hysteresis = 64;
+	power_limits.filter = 1000; // 1ms
+
+	power_fault = PowerFault_None;
+	power_fault_value = 0;
+	power_trips = 0;
+	power_blank = Power_BlankTicks;
+	power_clear();
+}
+
+void power_clear()
+{
+	for(int i=0;i<3;i++)
+	{
+		power_out[i] = 0;
+		power_count[i] = 0;
+	}
+	power_fault = PowerFault_None;
+	power_reported = 1;
+}
+
+void power_configure()
+{
+	// Both are 16bit, so the product fits in 32 bits.
+	int scans = ((unsigned int)power_limits.filter * adc_config.rate) / 1000000;
+	power_filter_scans = (scans < 1) ? 1 : scans;
+}
+
+void power_check(int vin, int v3v3, int v1v2)
+{
+	// Rails are only expected to be in range when fully on.
+	if(power_fault || power_blank > 0 || GetPowerDriveState() != 2)
+		return;
+
+	int sample[3] = { vin<<4, v3v3<<4, v1v2<<4 };
+	for(int i=0;i<3;i++)
+	{
+		int v = sample[i];
+		int low = power_limits.low[i], high = power_limits.high[i];
+		if(power_out[i] == 0)
+		{
+			if(v < low) power_out[i] = 1 + i*2;
+			else if(v > high) power_out[i] = 2 + i*2;
+		}
+		else if(power_out[i] & 1) // Low
+		{
+			if(v >= low + power_limits.hysteresis) power_out[i] = 0;
+		}
+		else
+		{
+			if(v <= high - power_limits.hysteresis) power_out[i] = 0;
+		}
+
+		if(power_out[i] == 0)
+		{
+			power_count[i] = 0;
+		}
+		else if(++power_count[i] >= power_filter_scans)
+		{
+			// Trip. Latch the fault before cutting power so SetPowerDriveState can't race us back on.
+			power_fault = power_out[i];
+			SetPowerDriveState(0);
+			power_fault_value = v;
+			power_trips++;
+			power_reported = 0;
+			dpc_trigger();
+			return;
+		}
+	}
+}
+
+void power_tick()
+{
+	if(power_blank > 0)
+		power_blank--;
+}
+
+void power_work()
+{
+	if(power_reported || Serial_BytesCanSend() < PowerRecord_Length)
+		return;
+
+	unsigned char record[PowerRecord_Length];
+	record[0] = PowerRecord_Fault;
+	record[1] = power_fault;
+	record[2] = power_fault_value & 0xFF;
+	record[3] = (power_fault_value >> 8) & 0xFF;
+	Serial_SendBytes(record, PowerRecord_Length);
+	power_reported = 1;
+	Serial_HintMoreData();
+}
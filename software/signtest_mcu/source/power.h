@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+
+#ifndef POWER_H
+#define POWER_H
+
+// Power rail protection.
+// Every ADC scan compares the rails (VIN, 3V3, 1V2) against per-rail limits. A rail that stays outside its limits
+// for `filter` microseconds cuts power immediately from the ADC interrupt, so the trip latency is bounded by the
+// filter time rather than by the host. The filter is counted in scans at the ADC rate, and is never less than one scan.
+// The fault is latched and power stays off until it is cleared.
+
+// Limits are 2:14 fixed point, the same scale as the status request (0x3FFF = 3.3V at the sense pin).
+// VIN is sensed through a 1/3 divider, 3V3 and 1V2 through 1/2 dividers.
+struct PowerLimits
+{
+	unsigned short low[3]; // VIN, 3V3, 1V2. Below this is an undervoltage (or overcurrent sag on VIN)
+	unsigned short high[3];
+	unsigned short hysteresis; // A rail must come back inside its limit by this much to be considered good again.
+	unsigned short filter; // Microseconds a rail must be out of limits to trip.
+};
+
+const int PowerFault_None = 0;
+// Other fault codes are 1 + rail*2 + (1 if over the high limit), rail being 0 = VIN, 1 = 3V3, 2 = 1V2.
+const int PowerFault_VinLow = 1;
+const int PowerFault_VinHigh = 2;
+const int PowerFault_3v3Low = 3;
+const int PowerFault_3v3High = 4;
+const int PowerFault_1v2Low = 5;
+const int PowerFault_1v2High = 6;
+
+// Rails aren't checked until this many timer ticks after the power state changes, to let them settle (100ms)
+const int Power_BlankTicks = 10;
+
+// Record sent on the bulk endpoint when a fault trips: type byte, fault code, 16bit value of the rail at the trip.
+const int PowerRecord_Fault = 0x02;
+const int PowerRecord_Length = 4;
+
+extern PowerLimits power_limits;
+extern volatile int power_fault;
+extern int power_fault_value;
+extern int power_trips;
+extern volatile int power_blank;
+extern int power_reported;
+
+void power_init();
+void power_configure(); // Convert the filter time to scans, after the limits or the ADC rate change
+void power_check(int vin, int v3v3, int v1v2); // Called from the ADC interrupt with raw 10bit values
+void power_tick(); // Called every timer tick
+void power_clear(); // Clear a latched fault, power stays off until the host turns it on again.
+void power_work(); // Report faults, called from the DPC.
+
+#endif
@@ -0,0 +1,272 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#include "lpc13xx.h"
+#include "stream.h"
+#include "framebuffer.h"
+#include "draw.h"
+#include "asset.h"
+#include "lz.h"
+#include "arena.h"
+#include "playback.h"
+#include "winusbserial.h"
+#include "system.h"
+#include "dpc.h"
+#include "io.h"
+
+int stream_command; // Command whose data is still arriving or being drawn, 0 when waiting for a new command
+int stream_count; // Pixels (WritePixels, DrawAsset, DrawAssetLz) or rows (Glyph) remaining in the current command
+int stream_address;
+int stream_frame; // Target frame for StreamCmd_PresentAt
+int stream_source; // Flash address of the next pixel for StreamCmd_DrawAsset
+LzDecoder stream_lz; // Decoder for StreamCmd_DrawAssetLz, its window is in the display arena
+
+int stream_masked_max;
+
+const int Stream_PassBytes = 512; // Stream data processed per pass with the USB IRQ disabled, one receive buffer (USBSER_BUFFER)
+const int Stream_AssetPixels = 16; // Asset pixels drawn at a time, each counts 3 bytes against the pass
+
+int glyph_x, glyph_y, glyph_width, glyph_flags;
+unsigned char glyph_colors[6]; // fg, bg
+
+void stream_init()
+{
+	stream_command = 0;
+	stream_count = 0;
+	stream_address = 0;
+	stream_frame = 0;
+	stream_masked_max = 0;
+}
+
+int stream_u32(const unsigned char* data)
+{
+	return data[0] | (data[1]<<8) | (data[2]<<16) | (data[3]<<24);
+}
+
+int stream_u16(const unsigned char* data)
+{
+	return data[0] | (data[1]<<8);
+}
+
+// Length of each command's fixed part, including the command byte.
+int stream_header_length(int cmd)
+{
+	switch(cmd)
+	{
+	case StreamCmd_WritePixels: return 5;
+	case StreamCmd_FillRect: return 12;
+	case StreamCmd_HLine: return 10;
+	case StreamCmd_VLine: return 10;
+	case StreamCmd_Glyph: return 14;
+	case StreamCmd_Present: return 1;
+	case StreamCmd_Scroll: return 3;
+	case StreamCmd_PresentAt: return 3;
+	case StreamCmd_DrawAsset: return 9;
+	case StreamCmd_DrawAssetLz: return 9;
+	}
+	return 1; // Discard unknown command bytes
+}
+
+void stream_start_command(const unsigned char* header)
+{
+	switch(header[0])
+	{
+	case StreamCmd_WritePixels:
+		stream_address = stream_u16(header+1);
+		stream_count = stream_u16(header+3);
+		if(stream_count)
+			stream_command = StreamCmd_WritePixels;
+		break;
+
+	case StreamCmd_FillRect:
+		draw_fill_rect(stream_u16(header+1), stream_u16(header+3), stream_u16(header+5), stream_u16(header+7), header+9);
+		break;
+
+	case StreamCmd_HLine:
+		draw_fill_rect(stream_u16(header+1), stream_u16(header+3), stream_u16(header+5), 1, header+7);
+		break;
+
+	case StreamCmd_VLine:
+		draw_fill_rect(stream_u16(header+1), stream_u16(header+3), 1, stream_u16(header+5), header+7);
+		break;
+
+	case StreamCmd_Glyph:
+		glyph_x = stream_u16(header+1);
+		glyph_y = stream_u16(header+3);
+		glyph_width = header[5];
+		stream_count = header[6];
+		glyph_flags = header[7];
+		memcpy(glyph_colors, header+8, 6);
+		if(glyph_width && stream_count)
+			stream_command = StreamCmd_Glyph;
+		break;
+
+	case StreamCmd_Present:
+		fb_present();
+		break;
+
+	case StreamCmd_Scroll:
+		fb_scroll_set(stream_u16(header+1));
+		break;
+
+	case StreamCmd_PresentAt:
+		stream_frame = stream_u16(header+1);
+		stream_command = StreamCmd_PresentAt;
+		break;
+
+	case StreamCmd_DrawAsset:
+	case StreamCmd_DrawAssetLz:
+		{
+			Asset asset;
+			if(!asset_open(stream_u32(header+1), &asset))
+				break;
+
+			stream_address = stream_u16(header+5);
+			stream_count = stream_u16(header+7);
+			if(header[0] == StreamCmd_DrawAsset)
+			{
+				// Never past the end of the asset.
+				if(stream_count == 0 || stream_count > (int)asset.length / 3)
+					stream_count = asset.length / 3;
+				stream_source = asset.address;
+			}
+			else
+			{
+				// The decoder window is shared with playback. Decoding stops where the asset does.
+				arena_claim(Arena_Display);
+				playback_stop();
+				lz_begin(&stream_lz, asset.address, asset.length, arena.display.lz_window);
+				if(stream_count == 0)
+					stream_count = 0xFFFF;
+			}
+			if(stream_count)
+				stream_command = header[0];
+		}
+		break;
+	}
+}
+
+// Process up to Stream_PassBytes of the stream. Returns 1 if it stopped there, and there may be more to do.
+int stream_pass()
+{
+	unsigned char buffer[48];
+	int budget = Stream_PassBytes;
+
+	while(1)
+	{
+		if(budget <= 0) return 1;
+		if(!fb_flip_ready()) break; // Drawing would wait for the flip, retried from the next SOF
+
+		if(stream_command == 0)
+		{
+			int cmd = Serial_PeekByte();
+			if(cmd == -1) break;
+			int length = stream_header_length(cmd);
+			if(Serial_RecvBytes(buffer, length) == -1) break; // Wait for the full header
+			budget -= length;
+			stream_start_command(buffer);
+		}
+		else if(stream_command == StreamCmd_WritePixels)
+		{
+			int count = Serial_BytesToRecv() / 3;
+			if(count == 0) break;
+			if(count > stream_count) count = stream_count;
+			if(count > (int)sizeof(buffer)/3) count = sizeof(buffer)/3;
+
+			Serial_RecvBytes(buffer, count*3);
+			budget -= count*3;
+			fb_write_begin(stream_address);
+			fb_write_rgb(buffer, count);
+
+			stream_address += count;
+			stream_count -= count;
+			if(stream_count == 0)
+				stream_command = 0;
+		}
+		else if(stream_command == StreamCmd_Glyph)
+		{
+			if(Serial_RecvBytes(buffer, (glyph_width+7)>>3) == -1) break; // Wait for a full row
+			budget -= (glyph_width+7)>>3;
+			draw_glyph_row(glyph_x, glyph_y, glyph_width, buffer, glyph_colors, (glyph_flags & GlyphFlag_Transparent) ? 0 : glyph_colors+3);
+			glyph_y++;
+			stream_count--;
+			if(stream_count == 0)
+				stream_command = 0;
+		}
+		else if(stream_command == StreamCmd_DrawAsset || stream_command == StreamCmd_DrawAssetLz)
+		{
+			int count = stream_count;
+			if(count > Stream_AssetPixels) count = Stream_AssetPixels;
+
+			budget -= count*3;
+			fb_write_begin(stream_address);
+			if(stream_command == StreamCmd_DrawAsset)
+			{
+				fb_write_flash(stream_source, count);
+				stream_source += count*3;
+			}
+			else if(lz_stream(&stream_lz, count) < count)
+			{
+				count = stream_count; // The asset has ended
+			}
+
+			stream_address += count;
+			stream_count -= count;
+			if(stream_count == 0)
+				stream_command = 0;
+		}
+		else if(stream_command == StreamCmd_PresentAt)
+		{
+			if(!fb_present_at(stream_frame)) break; // Retried once the SOF frees a page
+			stream_command = 0;
+		}
+		else
+		{
+			stream_command = 0;
+		}
+	}
+	return 0;
+}
+
+void stream_stop_lz()
+{
+	if(stream_command == StreamCmd_DrawAssetLz)
+		stream_command = 0;
+}
+
+void stream_work()
+{
+	// Control requests and the SOF may also use the SPI bus, so keep them out while the stream owns it.
+	// They get back in after each pass, and the rest of the DPC's work gets a turn before the next one.
+	InterruptDisable(INT_USBIRQ);
+	unsigned long start = systime_us();
+	int more = stream_pass();
+	int masked = systime_us() - start;
+	if(masked > stream_masked_max)
+		stream_masked_max = masked;
+	InterruptEnable(INT_USBIRQ);
+
+	Serial_HintMoreData(); // Space has been freed, let USB pull in more data.
+	if(more)
+		dpc_trigger();
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2016 Stephen Stair (sgstair@akkit.org)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+
+#ifndef STREAM_H
+#define STREAM_H
+
+// Command stream received on the bulk endpoint (EP3 OUT)
+// Each command is a command byte followed by its payload. Multi-byte values are little endian, coordinates are
+// canvas pixels and colors are 3 bytes (R,G,B).
+
+const int StreamCmd_WritePixels = 0x01; // u16 linear framebuffer address, u16 pixel count, then count*3 bytes of R,G,B data
+const int StreamCmd_FillRect = 0x02; // u16 x, u16 y, u16 width, u16 height, color
+const int StreamCmd_HLine = 0x03; // u16 x, u16 y, u16 length, color
+const int StreamCmd_VLine = 0x04; // u16 x, u16 y, u16 length, color
+const int StreamCmd_Glyph = 0x06; // u16 x, u16 y, u8 width, u8 height, u8 flags, fg color, bg color, then height rows of (width+7)/8 bytes, MSB first
+
+const int StreamCmd_Present = 0x08; // Show everything drawn since the last present, from the next FPGA frame (see fb_present)
+const int StreamCmd_Scroll = 0x09; // u16 scroll column, shown from the next FPGA frame (see fb_scroll_set)
+const int StreamCmd_PresentAt = 0x0A; // u16 USB frame number. Queue what was drawn since the last present for that SOF, waits while the queue is full (see fb_present_at)
+const int StreamCmd_DrawAsset = 0x0C; // u32 asset key, u16 linear framebuffer address, u16 pixel count (0 = the whole asset). The asset is R,G,B data (see asset.h)
+const int StreamCmd_DrawAssetLz = 0x0D; // u32 asset key, u16 linear framebuffer address, u16 pixel count (0 = until the data ends). The asset is LZ compressed R,G,B data (see lz.h). Stops playback.
+
+const int GlyphFlag_Transparent = 1; // Don't draw the background color
+
+extern int stream_masked_max; // Longest pass (us) with the USB IRQ disabled, reported with the frame queue status
+
+void stream_init();
+void stream_work(); // Process the next pass of the incoming stream, called from the DPC. Triggers the DPC again while there is more.
+void stream_stop_lz(); // Abandon a DrawAssetLz that is still being decoded, when its window is about to be reused
+
+#endif
@@ -39,6 +39,7 @@ void update_firmware()
 	for(i=0;i<=INT_MAX;i++) { InterruptDisable(i); }
 
 	// Turn off running hardware...
+	SYST_CSR = 0;
 	TMR32B1TCR = 0;
 	TMR32B1MCR = 0; // Disable or IAP will die a painful death.
 	TMR32B1MR0 = 0;
@@ -61,6 +62,67 @@ void update_firmware()
 	call_IAP_noreturn(command, result);
 }
 
+volatile unsigned long systime_base; // us at the last SysTick reload
+int systime_mhz;
+unsigned long boot_time[Boot_Milestones];
+
+void systime_init(int mhz)
+{
+	systime_base = 0;
+	for(int i=0;i<Boot_Milestones;i++)
+		boot_time[i] = 0xFFFFFFFF;
+	SHPR3 = (SHPR3 & 0x00FFFFFF) | (4<<27); // Below the ADC, so it can't delay a power trip.
+	systime_setclock(mhz);
+}
+
+void systime_setclock(int mhz)
+{
+	unsigned long now = systime_base;
+	if(SYST_CSR & 1)
+		now = systime_us();
+
+	SYST_CSR = 0;
+	systime_base = now;
+	systime_mhz = mhz;
+	SYST_RVR = mhz*1000 - 1; // 1ms
+	SYST_CVR = 0;
+	SYST_CSR = 7; // Enable, interrupt, core clock
+}
+
+unsigned long systime_us()
+{
+	unsigned long base, count;
+	do
+	{
+		base = systime_base;
+		count = SYST_CVR;
+	} while(base != systime_base);
+
+	// The counter may have reloaded just before it was read, without the interrupt having run yet (PENDSTSET).
+	if((ICSR & (1<<26)) && count > SYST_RVR/2)
+		base += 1000;
+	return base + (SYST_RVR - count) / systime_mhz;
+}
+
+void systime_wait_us(int us)
+{
+	unsigned long start = systime_us();
+	while(systime_us() - start < (unsigned long)us);
+}
+
+extern "C" void int_SysTick();
+void int_SysTick()
+{
+	systime_base += 1000;
+}
+
+void boot_mark(int milestone)
+{
+	if(boot_time[milestone] == 0xFFFFFFFF)
+		boot_time[milestone] = systime_us();
+}
+
+
 unsigned long UID[4];
 void ReadDeviceUID()
 {
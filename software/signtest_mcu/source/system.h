@@ -39,11 +39,31 @@ extern unsigned long UID[4];
 extern "C" void memcpy(void* dest, const void* src, int length);
 
 
+// System time: SysTick runs from the start of main() with a 1ms period and keeps a microsecond clock.
+void systime_init(int mhz); // mhz = current core clock
+void systime_setclock(int mhz); // Call right after the core clock changes
+unsigned long systime_us();
+void systime_wait_us(int us);
+
+// Boot milestones, recorded the first time they are reached (in us since main() started, 0xFFFFFFFF if not reached yet)
+const int Boot_Start = 0;
+const int Boot_DeviceUID = 1; // IAP returned the UID
+const int Boot_OscStarted = 2; // Crystal oscillator past its minimum startup time
+const int Boot_PllLocked = 3; // System and USB PLLs locked
+const int Boot_ClockSwitched = 4; // Running at 24MHz
+const int Boot_Peripherals = 5; // ADC, timers, SPI and firmware modules initialized
+const int Boot_UsbConnect = 6; // Soft-connect enabled
+const int Boot_UsbReset = 7; // First bus reset from the host
+const int Boot_UsbAddress = 8;
+const int Boot_UsbConfigured = 9;
+const int Boot_Milestones = 10;
+
+extern unsigned long boot_time[Boot_Milestones];
+void boot_mark(int milestone);
+
+// Compile time check, fails with a negative array size.
+#define STATIC_ASSERT(condition, name) typedef char static_assert_##name[(condition) ? 1 : -1]
 
 
-static const int adc_history_length = 64;
-
-extern unsigned short adc_history[3+5*adc_history_length]; // 646 bytes of history, about 6ms worth.
-
 
 #endif
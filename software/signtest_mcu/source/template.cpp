@@ -31,6 +31,13 @@ typedef unsigned long u32;
 #include "dpc.h"
 #include "winusbserial.h"
 #include "fifobuf.h"
+#include "framebuffer.h"
+#include "stream.h"
+#include "playback.h"
+#include "power.h"
+#include "adc.h"
+#include "arena.h"
+#include "asset.h"
 
 
 
@@ -81,7 +88,7 @@ int led_red;
 
 void led_set_red_internal(int value)
 {
-	GPIO0DIR |= (1<<5);
+	GpioDirSet(0, 1<<5);
 	GPIO0DATA[(1<<5)] = value?0:(1<<5);
 }
 
@@ -104,7 +111,7 @@ void led_busy(int busy)
 
 void led_set_green(int value)
 {
-	GPIO0DIR |= (1<<4);
+	GpioDirSet(0, 1<<4);
 	GPIO0DATA[(1<<4)] = value?0:(1<<4);
 }
 
@@ -114,27 +121,34 @@ void led_set_green(int value)
 int power_state;
 void SetPowerDriveState(int value) // 0 = off, 1 = soft-on, 2=on
 {
+	if(power_fault)
+		value = 0; // A latched power fault keeps the drive off until it's cleared.
+
 	if(value&2)
 	{
-		GPIO1DIR |= (1<<10); // Pull gate line down to enable the P-fet
+		GpioDirSet(1, 1<<10); // Pull gate line down to enable the P-fet
 		GPIO1DATA[1<<10] = 0;
 	}
 	else
 	{
-		GPIO1DIR &= ~(1<<10); // Release gate line and it will float up to 5V to turn off the P-fet
+		GpioDirClear(1, 1<<10); // Release gate line and it will float up to 5V to turn off the P-fet
 	}
 
 	if(value&1)
 	{
-		GPIO0DIR |= (1<<7);
+		GpioDirSet(0, 1<<7);
 		GPIO0DATA[1<<7] = 0;
 	}
 	else
 	{
-		GPIO0DIR &= ~(1<<7);
+		GpioDirClear(0, 1<<7);
 	}
 	
 	power_state = value;
+	power_blank = Power_BlankTicks; // Let the rails settle before checking them again.
+
+	if(value && power_fault)
+		SetPowerDriveState(0); // The ADC interrupt tripped while we were turning on.
 }
 
 int GetPowerDriveState()
@@ -147,14 +161,14 @@ int GetPowerDriveState()
 // PIO1_9 (0) - SENSE2 
 int GetSense() // Returns bottom 2 bits as sense pin status. Zero means board is present.
 {
-	GPIO1DIR &= ~(0x300);
+	GpioDirClear(1, 0x300);
 	return (GPIO1DATA[0x300] >> 8) & 3;
 }
 
 
 int GetButton() // Return 1 when PROG button is pressed.
 {
-	GPIO0DIR &= ~(1<<1);
+	GpioDirClear(0, 1<<1);
 	return (GPIO0DATA[2] == 0);
 }
 
@@ -180,12 +194,13 @@ const int FlashCmd_PowerDown = 0xB9;
 const int FlashCmd_ReleasePowerDown = 0xAB;
 
 
+
 // PIO1_2 (1D) - FPGA_PROG#
 void fpga_prog(int halt) // 1 = stop FPGA, 0 = run FPGA
 {
 
 	// halt
-	GPIO1DIR |= 1<<2;
+	GpioDirSet(1, 1<<2);
 	GPIO1DATA[1<<2] = 0;
 
 	if(!halt)
@@ -199,7 +214,7 @@ void fpga_prog(int halt) // 1 = stop FPGA, 0 = run FPGA
 // PIO1_5 (0) - FLASH_CS#
 void flash_csenable(int enable)
 {
-	GPIO1DIR |= (1<<5);
+	GpioDirSet(1, 1<<5);
 	GPIO1DATA[(1<<5)] = enable?0:(1<<5);
 }
 
@@ -217,8 +232,8 @@ void SpiRelease()
 	IOCON_PIO0_8 = 0;								// PIO0_8 (1) - FLASH_MISO (SSP MISO) (also for FPGA)
 	IOCON_PIO0_9 = 0;								// PIO0_9 (1) - FLASH_MOSI (SSP MOSI) (also for FPGA)
 	IOCON_PIO0_10 = 1;								// PIO0_10 (2) - FLASH_CLK (SSP SCK) (also FPGA)
-	GPIO0DIR &= ~(0x700);
-	GPIO1DIR &= ~(1<<5);
+	GpioDirClear(0, 0x700);
+	GpioDirClear(1, 1<<5);
 }
 void SpiEngage()
 {
@@ -253,7 +268,7 @@ void SpiInit()
 	
 	// Also enforce an input pin
 	// PIO1_3 FPGA_DONE
-	GPIO1DIR &= ~(1<<3);
+	GpioDirClear(1, 1<<3);
 	
 	InterruptSetPriority(INT_SSP,64);
 	
@@ -269,6 +284,21 @@ int SpiByte(int byte)
 	return SSP0DR;
 }
 
+// Queue a byte for transmission without waiting for it to complete. Received data is discarded.
+void SpiWriteByte(int byte)
+{
+	while((SSP0SR&2)==0);
+	SSP0DR = byte;
+	while(SSP0SR&4) SSP0DR;
+}
+
+// Wait for all queued bytes to leave the SSP, must be called before changing chip selects.
+void SpiWriteComplete()
+{
+	while(SSP0SR&0x10) { while(SSP0SR&4) SSP0DR; }
+	while(SSP0SR&4) SSP0DR;
+}
+
 void SpiData(unsigned char * dataIn, unsigned char * dataOut, int length)
 {
 	int readcursor = 0;
@@ -442,8 +472,6 @@ int fpga_waitboot()
 }
 
 
-
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  System / Timing
@@ -484,8 +512,6 @@ unsigned int timer_wait_tick()
 	return timer_get_tick();
 }
 
-void ad_work();
-
 extern "C" void int_CT32B1();
 void int_CT32B1()
 {
@@ -501,75 +527,7 @@ void int_CT32B1()
 
 
 
-int adc_last[3];
-
-int adc_count;
-int adc_temp[3];
-
-extern "C" void int_ADC(); // occurs about 14k times a second, once every 1700 cycles.
-void int_ADC()
-{
-	adc_temp[0] += ((AD0DR0>>6)&0x3FF);
-	adc_temp[1] += ((AD0DR1>>6)&0x3FF);
-	adc_temp[2] += ((AD0DR2>>6)&0x3FF);
-	adc_count++;
-	if(adc_count == 16)
-	{
-		for(int i=0;i<3;i++)
-		{
-			adc_last[i] = adc_temp[i];
-			adc_temp[i] = 0;
-		}
-		adc_count = 0;
-	}
-	
-	InterruptClear(INT_ADC);
-}
-
-
-
-void ad_init()
-{
-
-	PDRUNCFG &= ~(1<<4); // turn on power to ADC;
-	InterruptDisable(INT_ADC);
-
-	adc_count = 0;
-	adc_temp[0] = adc_temp[1] = adc_temp[2] = 0;
-	adc_last[0] = adc_last[1] = adc_last[2] = 0;
-
-	// Setup ADCs
-	AD0CR = 0;
-	// Todo: maybe set up interrupts. For now just convert.
-	InterruptClear(INT_ADC);
-	InterruptSetPriority(INT_ADC,0); // HIGHEST priority.
-
-	AD0INTEN = 0x04; // Interrupt on AD2 conversion.
-	AD0CR = 0x07 | // SEL = AD0,1,2
-			(39<<8) | // CLKDIV = 39 (divide by 40) - to achieve 0.6MHz (should be <= 4.5 MHz)
-			(1<<16); // BURST - hardware scan through ADC conversions.
-	// Burst conversions of 3 ADCs (33 cycles) = approximately 14khz
-
-
-	InterruptEnable(INT_ADC);
-}
-
-
-// adc update worker task. every tick, wake up and do some stuff.
-void ad_work()
-{
-	// Read ADCs
-	dpc_suspend();
-	InterruptDisable(INT_ADC);
-
-
-
-	InterruptEnable(INT_ADC);
-	dpc_resume();
-
-
-}
-
+const int Boot_OscStartupUs = 500; // Minimum crystal startup before it's fed to the PLLs (NXP's own startup code waits far less)
 
 //---------------------------------------------------------------------------------
 // Program entry point
@@ -579,7 +537,17 @@ int main(void) {
 
 	SYSAHBCLKCTRL = 0x16D5F; // Turn on clock to important devices (gpio, iocon, CT16B1, CT32B1, ADC)
 
+	int on_irc = (MAINCLKSEL&3) == 0; // Assuming we are running on the RC osc..
+	systime_init(on_irc ? 12 : 24);
+	boot_mark(Boot_Start);
 
+	// Wake up the Crystal OSC now, it can start up while the pins are set up.
+	unsigned long osc_start = systime_us();
+	if(on_irc)
+	{
+		SYSOSCCTRL = 0;
+		PDRUNCFG = 0x040 | 0x400; // Turn on SYSOSC, SYSPLL, USBPLL, ADC (not usb yet)
+	}
 	
 	IOCON_PIO0_5 = 0; 								// PIO0_5 (0) - LEDGREEN
 	IOCON_PIO0_4 = 0; 								// PIO0_4 (0) - LEDRED
@@ -618,19 +586,20 @@ int main(void) {
 
 
 	// Set default values for critical pins
+	power_init();
 	SetPowerDriveState(0);
 	led_set_red(0);
 	led_set_green(1);
 
 	ReadDeviceUID();
+	boot_mark(Boot_DeviceUID);
 
 	// Set up clocks for USB.
-	if((MAINCLKSEL&3) == 0) // Assuming we are running on the RC osc..
+	if(on_irc)
 	{
-		// Wake up the Crystal OSC
-		SYSOSCCTRL = 0;
-		PDRUNCFG = 0x040 | 0x400; // Turn on SYSOSC, SYSPLL, USBPLL, ADC (not usb yet)
-		delayms(5); // Give clock some time to warm up
+		// The PLL lock bits are the real readiness indication, only give the crystal a minimum startup time before feeding the PLLs.
+		while(systime_us() - osc_start < Boot_OscStartupUs);
+		boot_mark(Boot_OscStarted);
 		// Setup SYSPLL to provide 24MHz cpu CLK. M=2, P=4
 		// Note that 24MHz is technically out of spec (should set waitstates for flash at >20MHz), but this works and is simpler.
 		SYSPLLCTRL = 0x41;
@@ -643,17 +612,17 @@ int main(void) {
 		USBPLLCLKUEN=0;
 		USBPLLCLKUEN=1; // Update clock source
 
-		// Wait for PLLs to stabilize
+		// Wait for PLLs to lock
 		while((SYSPLLSTAT&1) == 0);
 		while((USBPLLSTAT&1) == 0);
-		delayms(100);
+		boot_mark(Boot_PllLocked);
 		// Switch system clock over to PLL clock
 		MAINCLKSEL = 3;
 		MAINCLKUEN = 0;
 		MAINCLKUEN = 1;
+		systime_setclock(24);
 	}
-
-	delayms(10);
+	boot_mark(Boot_ClockSwitched);
 
 	SpiInit();
 	SpiRelease();
@@ -662,8 +631,14 @@ int main(void) {
 	// Setup periodic timer at 125ms intervals.
 	timer_init();
 
+	arena_init();
+	fb_init();
+	stream_init();
+	playback_init();
+
 	dpc_init();
 	dpc_suspend();
+	boot_mark(Boot_Peripherals);
 
 
 	PDRUNCFG &= ~0x400; // Turn on USB
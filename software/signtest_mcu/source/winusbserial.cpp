@@ -26,6 +26,12 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 #include "fifobuf.h"
 #include "dpc.h"
 #include "io.h"
+#include "framebuffer.h"
+#include "playback.h"
+#include "power.h"
+#include "adc.h"
+#include "arena.h"
+#include "stream.h"
 
 
 char config;
@@ -39,19 +45,42 @@ int flash_lockout; // 0 = don't know flash status or incorrect flash chip. 1 = f
 
 unsigned char *incoming_data_location;
 int incoming_data_length;
-
-unsigned char scratch_pad[256];
-
-unsigned char config_bytes[800];
-
-const char * string1 = "MatrixDriver"; // Manufacturer
-const char * string2 = "MatrixDriver Test Device"; // Device name
-
-const char* os_stringdescriptor = "MSFT100A"; // Specify bRequest 0x41 ("A") as the OS Feature descriptor request.
-
-
-const char* ext_prop_names[] = { "DeviceInterfaceGUID" };
-const char* ext_prop_values[] = { "{b86d3dd6-c9d8-4401-959b-efbbd9bf1f3c}" };
+void (*incoming_data_complete)(); // Optionally called once all incoming data has been received.
+
+// Control transfer replies. Descriptors are sent straight from ROM, larger host transfers go through the scratch pad in the arena.
+unsigned char config_bytes[48];
+STATIC_ASSERT(sizeof(boot_time) + 4 <= sizeof(config_bytes), boot_timing_fits_config_bytes);
+
+// String descriptors are UTF-16, so they are written out a character at a time here and sent as they are.
+// The first word holds the descriptor length byte and type (3).
+#define USB_STRING_HEADER(chars) (0x300 | (2 + (chars)*2))
+#define USB_U32(value) ((value) & 0xFFFF), (((value) >> 16) & 0xFFFF)
+
+const unsigned short usbstring_manufacturer[] = { USB_STRING_HEADER(12),
+	'M','a','t','r','i','x','D','r','i','v','e','r' };
+STATIC_ASSERT(sizeof(usbstring_manufacturer) == 2 + 12*2, manufacturer_string_length);
+
+const unsigned short usbstring_product[] = { USB_STRING_HEADER(24),
+	'M','a','t','r','i','x','D','r','i','v','e','r',' ','T','e','s','t',' ','D','e','v','i','c','e' };
+STATIC_ASSERT(sizeof(usbstring_product) == 2 + 24*2, product_string_length);
+
+const unsigned short usbstring_os[] = { USB_STRING_HEADER(8),
+	'M','S','F','T','1','0','0','A' }; // Specify bRequest 0x41 ("A") as the OS Feature descriptor request.
+STATIC_ASSERT(sizeof(usbstring_os) == 2 + 8*2, os_string_length);
+
+// Hex digits of the chip UID, built once by usb_init.
+unsigned short usbstring_serial[1 + 32];
+
+// Extended properties OS descriptor, giving the WinUSB interface its GUID.
+const unsigned short os_ext_prop_descriptor[] = {
+	USB_U32(142), 0x0100, 5, 1, // Length, version 1.00, extended properties index, 1 property
+	USB_U32(132), USB_U32(1), // Property length, type REG_SZ
+	40, // Name length in bytes, including the terminator
+	'D','e','v','i','c','e','I','n','t','e','r','f','a','c','e','G','U','I','D',0,
+	USB_U32(78), // Value length in bytes
+	'{','b','8','6','d','3','d','d','6','-','c','9','d','8','-','4','4','0','1','-','9','5','9','b','-','e','f','b','b','d','9','b','f','1','f','3','c','}',0
+};
+STATIC_ASSERT(sizeof(os_ext_prop_descriptor) == 142, ext_prop_length);
 
 
 
@@ -151,26 +180,74 @@ int usb_IsActive()
 }
 
 
+// The bulk endpoints (EP3 IN/OUT) are serviced by the USB FIQ, which preempts the USB IRQ.
+// The SIE command interface, USBCTRL and the selected endpoint are shared, so code in the IRQ holds the FIQ off while
+// it uses them. The hold nests; a FIQ that comes in meanwhile stays pending in the NVIC and runs on release.
+unsigned char usb_holdcount;
+
+// Bulk endpoint cost, accumulated by int_USBFIQ until read with vendor request 0x3B.
+unsigned long usb_bulk_cycles, usb_bulk_calls, usb_bulk_packets;
+const int Usb_FiqOverhead = 24; // Cycles of interrupt entry/exit not seen by the FIQ's own timing (as Adc_IsrOverhead)
+
+volatile int usb_frame;
+volatile unsigned long usb_clock;
+
+// SOF timing, since the last read with vendor request 0x3F. Timestamped in the FIQ (usbfiq_frame), so the DPC masking the IRQ
+// doesn't show up as jitter; what's left is FIQ latency (the ADC and usb_hold sections).
+volatile unsigned long usb_sof_time; // systime_us and frame number of the newest SOF, written by the FIQ
+volatile int usb_sof_frame;
+volatile int usb_sof_pending; // The IRQ hasn't handled the newest SOF yet
+unsigned long usb_sof_us; // usb_sof_time as of the last SOF the IRQ handled
+unsigned long usb_sof_jitter_sum; // Sum of each SOF's distance from where it was expected, in us
+unsigned short usb_sof_jitter_max;
+unsigned short usb_sof_count;
+
+void usb_hold()
+{
+	InterruptDisable(INT_USBFIQ);
+	asm volatile("dsb\n\tisb"); // Make sure the FIQ can't be taken after this point.
+	usb_holdcount++;
+}
+
+void usb_release()
+{
+	if(--usb_holdcount == 0)
+		InterruptEnable(INT_USBFIQ);
+}
+
+void usb_release_all()
+{
+	usb_holdcount = 0;
+	InterruptEnable(INT_USBFIQ);
+}
+
+void usb_rehold()
+{
+	if(usb_holdcount == 0)
+		usb_hold();
+}
+
+
 // USB! We all love USB.
 
 // SIE interface, documented in LPC 13xx user manual section 9.10.2. Examples in 9.11
+// Command and write phases complete with CCEMPTY, a read phase with CDFULL; nothing else needs to be waited for.
 void Usb_SendCmd(unsigned long cmd)
 {
-	USBDEVINTCLR = 0xC00;
+	USBDEVINTCLR = 0x400;
 	USBCMDCODE = cmd | USBCMD_PHASE_COMMAND;
 	while(!(USBDEVINTST & 0x400));
 }
 void Usb_SendData(unsigned char data)
 {
-	USBDEVINTCLR = 0xC00;
+	USBDEVINTCLR = 0x400;
 	USBCMDCODE = (data<<16) | USBCMD_PHASE_WRITE;
 	while(!(USBDEVINTST & 0x400));
 }
 unsigned char Usb_RecvData()
 {
-	USBDEVINTCLR = 0xC00;
+	USBDEVINTCLR = 0x800;
 	USBCMDCODE = USBCMD_PHASE_READ;
-	while(!(USBDEVINTST & 0x400));
 	while(!(USBDEVINTST & 0x800));
 	return USBCMDDATA&255;
 }
@@ -278,51 +355,41 @@ void Usb_ValidateBuffer()
 // Further wrappers to do helpful things
 // Everything uses "physical" endpoint numbers. See LPC13xx user manual section 9.5
 
-// Read the length of an incoming packet on a specific endpoint (assuming there is a packet)
+// The packet buffer interface (USBCTRL) needs no delays: a read waits for PKT_RDY once, writes need no wait at all.
+// LPC13xx user manual section 9.11 (and NXP's reference driver) for the sequences.
+
+// Open the next packet on an OUT endpoint for reading (assuming there is a packet) and return its length.
+// The data then has to be read with ReadPacketData before using USBCTRL again.
 int ReadPacketLength(int ep) 
 {
 	if((ep&1)==1) return 0; // Can't read from IN endpoint
-	ep = ep>>1;
-	ep = ep * 4 + 1;
-	USBCTRL = ep;
-	delayus(0);
-	int rxlen = (int)USBRXPLEN;
-	if(!(rxlen&0x400)) rxlen = 0;
+	USBCTRL = (ep>>1)*4 + 1; // Logical endpoint, RD_EN
+	int rxlen;
+	while(!((rxlen = (int)USBRXPLEN) & 0x800)); // PKT_RDY
+	if(!(rxlen&0x400)) rxlen = 0; // DV
 	return rxlen&0x3FF;
 }
 
-// Copy the next available packet on a specific endpoint (assuming there is a packet) into the buffer specified
-void ReadPacket(int ep, void* data, int length) // Note: round up to the next multiple of 4 bytes for buffer space.
+// Copy the packet opened by ReadPacketLength into the buffer specified (may be less than the full packet)
+void ReadPacketData(void* data, int length) // Note: round up to the next multiple of 4 bytes for buffer space.
 {
-	if((ep&1)==1) return; // Can't read from IN endpoint
-	ep = ep>>1;
-	ep = ep*4 + 1;
-	USBCTRL = ep;
-	delayus(0);
-	int i=0;
-	while((i*4)<length)
-	{
-		((unsigned long *)data)[i] = USBRXDATA;
-		i++;
-	}
+	unsigned long* words = (unsigned long*)data;
+	for(int i=0;i<length;i+=4)
+		*words++ = USBRXDATA;
+	USBCTRL = 0;
 }
 
 // Send a packet on a specific endpoint (Assuming there is buffer space available) using the buffer specified
 void WritePacket(int ep, void* data, int length)
 {
 	if((ep&1)==0) return; // Can't write to OUT endpoint
-	ep = ep>>1;
-	ep = ep*4 + 2;
-	USBCTRL = ep;
-	delayus(0);
+	USBCTRL = (ep>>1)*4 + 2; // Logical endpoint, WR_EN
 	USBTXPLEN = length;
-	int i=0;
+	unsigned long* words = (unsigned long*)data;
 	if(length==0) length=1;
-	while((i*4)<length)
-	{
-		USBTXDATA = ((unsigned long *)data)[i];
-		i++;
-	}
+	for(int i=0;i<length;i+=4)
+		USBTXDATA = *words++;
+	USBCTRL = 0;
 }
 
 
@@ -351,15 +418,15 @@ void continue_configdata()
 	int pktlen;
 	if(!configdata_start) return; // No packet in flight.
 
+	usb_hold();
 	USBDEVINTCLR = 4; // Clear EP1 interrupt
-	Usb_SelectEndpointClearInterrupt(1); // clear endpoint interrupt.
+	int status = Usb_SelectEndpointClearInterrupt(1); // clear endpoint interrupt.
 	while(1)
 	{
 		pktlen = configdata_length - configdata_cursor;
 		if(pktlen > 64) pktlen = 64;
 
 		// Can we send a further packet?
-		int status = Usb_SelectEndpoint(1);
 		if(status&1) break; // No empty buffers remain.
 
 		WritePacket(1, ((char*)configdata_start)+configdata_cursor, pktlen); // Everything uses "physical" endpoint numbers. See LPC13xx user manual section 9.5
@@ -373,8 +440,9 @@ void continue_configdata()
 
 			break;
 		}
-
+		status = Usb_SelectEndpoint(1);
 	}
+	usb_release();
 }
 
 // Send descriptor/etc data back down the config channel
@@ -408,140 +476,28 @@ void send_config1byte(unsigned char byte1, int maxlength)
 	send_configdata(config_bytes,1,maxlength);
 }
 
-void send_stringdescriptor(const char* string, int maxlength)
-{
-	// Convert string to string descriptor
-	config_bytes[0] = 0; // Will be descriptor length
-	config_bytes[1] = 3;
-
-	int i = 2;
-	while(*string && i<(int)sizeof(config_bytes))
-	{
-		config_bytes[i++] = *string++;
-		config_bytes[i++] = 0;
-	}
-	config_bytes[0] = (unsigned char)i;
-
-	send_configdata(config_bytes, i, maxlength);
-}
-
-void send_serialnumber(int maxlength)
+void usb_build_serial()
 {
 	unsigned char * serialnumber = (unsigned char *)UID;
-	// Convert string to string descriptor
-	config_bytes[0] = 0; // Will be descriptor length
-	config_bytes[1] = 3;
-
-	int i = 2;
-	int n = 0;
-	while(n<16)
+	usbstring_serial[0] = USB_STRING_HEADER(32);
+	for(int n=0;n<32;n++)
 	{
-		char digit;
-
-		digit = (serialnumber[15-n]>>4)&15;
-		if(digit > 9) digit+= 'A'-10; else digit += '0';
-		config_bytes[i++] = digit;
-		config_bytes[i++] = 0;
-
-		digit = serialnumber[15-n] & 15;
-		if(digit > 9) digit+= 'A'-10; else digit += '0';
-		config_bytes[i++] = digit;
-		config_bytes[i++] = 0;
-		n++;
+		int digit = (serialnumber[15-(n>>1)] >> ((n&1) ? 0 : 4)) & 15;
+		usbstring_serial[1+n] = (digit > 9) ? digit + 'A' - 10 : digit + '0';
 	}
-	config_bytes[0] = (unsigned char)i;
-
-	send_configdata(config_bytes, i, maxlength);
 }
 
-int strlen(const char* string)
+
+void usb_clock_epoch(unsigned long clock, int frame)
 {
-	int i = 0;
-	while(*string++) i++;
-	return i;
+	usb_clock = clock + ((usb_frame - frame) & 0x7FF);
 }
 
-void send_ext_prop(int propcount, const char** const names, const char** const values, int maxlength)
+void usb_clock_set()
 {
-	// Determine length
-	int totallength = 10;
-	int i;
-	for(i=0;i<propcount;i++)
-	{
-		totallength += 14 + strlen(names[i])*2 + strlen(values[i])*2 + 4;
-	}
-
-	if(totallength > (int)sizeof(config_bytes))
-	{
-		// Can't really do much here.
-		return;
-	}
-
-	// Generate header
-	i = 0;
-	config_bytes[i++] = totallength&255;
-	config_bytes[i++] = (totallength>>8)&255;
-	config_bytes[i++] = 0;
-	config_bytes[i++] = 0;
-
-	config_bytes[i++] = 0;
-	config_bytes[i++] = 0x01;
-
-	config_bytes[i++] = 5;
-	config_bytes[i++] = 0;
-
-	config_bytes[i++] = propcount;
-	config_bytes[i++] = 0;
-	
-
-	// for each property...
-	for(int n=0; n<propcount; n++)
-	{
-		const char* string;
-		int len = 14 + 4 + strlen(names[n])*2 + strlen(values[n])*2; 
-		
-		config_bytes[i++] = len&255;
-		config_bytes[i++] = (len>>8)&255;
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-	
-		config_bytes[i++] = 1; // Data type = 1, REG_SZ
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-	
-		len = strlen(names[n])*2 + 2;
-		config_bytes[i++] = len&255;
-		config_bytes[i++] = (len>>8)&255;
-
-		string = names[n];
-		while(*string)
-		{
-			config_bytes[i++] = *string++;
-			config_bytes[i++] = 0;
-		}
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-
-
-		len = strlen(values[n])*2 + 2;
-		config_bytes[i++] = len&255;
-		config_bytes[i++] = (len>>8)&255;
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-
-		string = values[n];
-		while(*string)
-		{
-			config_bytes[i++] = *string++;
-			config_bytes[i++] = 0;
-		}
-		config_bytes[i++] = 0;
-		config_bytes[i++] = 0;
-	}
-
-	send_configdata(config_bytes, totallength, maxlength);
-
+	unsigned long values[2];
+	memcpy(values, config_bytes, 8);
+	usb_clock_epoch(values[0], values[1]);
 }
 
 
@@ -553,9 +509,13 @@ void HandleSetupPacket()
 
 	if(ReadPacketLength(0) == 8) // Setup packets should be length 8
 	{
-		ReadPacket(0, setupreq, 8);
+		ReadPacketData(setupreq, 8);
 		readpacket = 1;
 	}
+	else
+	{
+		USBCTRL = 0; // Close the read ReadPacketLength opened, or the next packet buffer access goes to the wrong place
+	}
 	Usb_SelectEndpoint(0);
 	Usb_ClearBuffer();
 
@@ -565,6 +525,7 @@ void HandleSetupPacket()
 	configdata_start = 0;
 	shouldackin0 = 0;
 	incoming_data_location = 0;
+	incoming_data_complete = 0;
 
 	// Decode fields for convenience.
 	unsigned char bmRequestType = setupreq[0];
@@ -589,6 +550,7 @@ void HandleSetupPacket()
 		case 5: // SET_ADDRESS 
 			if(bmRequestType != 0) break;
 			Usb_SetAddress(1,wValue&127); // Address will be set after this exchange completes.
+			boot_mark(Boot_UsbAddress);
 			WritePacket(1,setupreq,0);
 			Usb_SelectEndpoint(1);
 			Usb_ValidateBuffer();
@@ -615,17 +577,16 @@ void HandleSetupPacket()
 					}
 					return;
 				case 1:
-					send_stringdescriptor(string1, wLength);
+					send_configdata(usbstring_manufacturer, sizeof(usbstring_manufacturer), wLength);
 					return;
 				case 2:
-					send_stringdescriptor(string2, wLength);
+					send_configdata(usbstring_product, sizeof(usbstring_product), wLength);
 					return;
 				case 3:
-					send_serialnumber(wLength);
-					//send_stringdescriptor(string3, wLength);
+					send_configdata(usbstring_serial, sizeof(usbstring_serial), wLength);
 					return;
 				case 0xEE: // OS String descriptor
-					send_stringdescriptor(os_stringdescriptor, wLength);
+					send_configdata(usbstring_os, sizeof(usbstring_os), wLength);
 					return;
 				}
 			}
@@ -641,6 +602,7 @@ void HandleSetupPacket()
 			if(wValue > 1) break;
 			config = wValue;
 			Usb_ConfigureDevice((char)config);
+			if(config) boot_mark(Boot_UsbConfigured);
 			goto success;
 		case 10: // GET_INTERFACE
 		case 11: // SET_INTERFACE
@@ -652,6 +614,8 @@ void HandleSetupPacket()
 		break;
 
 	case 2: // Vendor requests
+		fb_flush(); // Many of these use the SPI bus, so release the FPGA from any open pixel burst.
+		usb_release_all(); // These can take a while, keep the bulk endpoints going meanwhile. Replies take the hold again.
 		switch(bRequest)
 		{
 			// In this device, custom vendor requests must be device targeted device->host or host->device requests.
@@ -683,6 +647,7 @@ void HandleSetupPacket()
 				if(bmRequestType != 0xC0) // Device to host.
 					break;
 				
+				playback_stop(); // Any mode change disturbs the FPGA or the flash.
 				{
 					int result = 1;	
 					switch(wValue)
@@ -718,11 +683,20 @@ void HandleSetupPacket()
 						SpiRelease();
 						fpga_prog(0); // This will reset the FPGA even if it was 0 previously.
 						result = !fpga_waitboot(); // returns 0 on success.
+						if(!result)
+						{
+							fb_fpga_reset();
+							if(flash_locked())
+								gamma_load(); // Pick up saved color correction if the flash has it.
+						}
 						break;
-						
+
 					default:
 						result = 0;
 					}
+
+					if(wValue != 0 && power_fault)
+						result = 0; // Power stays off until the fault is cleared.
 						
 					send_config1byte(result, wLength);	
 				}
@@ -739,11 +713,45 @@ void HandleSetupPacket()
 					
 				send_config1byte(GetButton(), wLength);
 				return;
+
+			case 0x16: // Read/Write power protection limits (16 bytes, see PowerLimits)
+				if(wLength != sizeof(PowerLimits))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(&power_limits, sizeof(PowerLimits), wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					incoming_data_location = (unsigned char*)&power_limits;
+					incoming_data_length = sizeof(PowerLimits);
+					incoming_data_complete = power_configure;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x17: // Power fault status. wValue = 1 to clear a latched fault. Returns fault code, power state, 16bit rail value at the trip, 16bit trip count.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				config_bytes[0] = power_fault;
+				config_bytes[1] = GetPowerDriveState();
+				config_bytes[2] = power_fault_value & 0xFF;
+				config_bytes[3] = (power_fault_value >> 8) & 0xFF;
+				config_bytes[4] = power_trips & 0xFF;
+				config_bytes[5] = (power_trips >> 8) & 0xFF;
+				if(wValue == 1)
+					power_clear();
+				send_configdata(config_bytes, 6, wLength);
+				return;
 				
 			case 0x18: // Read/Write scratch pad. Scratch pad is a 256-byte area used to collect data for programming 256-bytes at a time, or SPI transfers.
 				// wValue = offset in scratch pad to start operation. wLength = length of read/write operation
 				if(wLength > 256)
 					break;
+				arena_claim(Arena_Service);
 					
 				if(bmRequestType == 0xC0)
 				{
@@ -753,7 +761,7 @@ void HandleSetupPacket()
 						// Clip length if it would overrun the buffer (make host side code simpler)
 						wLength = 256-wValue;
 					}
-					send_configdata(scratch_pad + wValue, wLength, wLength);
+					send_configdata(arena.service.scratch_pad + wValue, wLength, wLength);
 					return;
 				} 
 				else if(bmRequestType == 0x40)
@@ -762,16 +770,17 @@ void HandleSetupPacket()
 					if(wValue + wLength > 256)
 						break; // Cannot tolerate host sending too much data.
 
-					incoming_data_location = scratch_pad + wValue;
+					incoming_data_location = arena.service.scratch_pad + wValue;
 					incoming_data_length = wLength;
 					return; // To be completed by the incoming data handler.
 				}
 				break;
 				
 			case 0x19: // Fill scratch pad with 0xFF
+				arena_claim(Arena_Service);
 				for(int i = 0; i < 256; i++)
 				{
-					scratch_pad[i] = 0xFF;
+					arena.service.scratch_pad[i] = 0xFF;
 				}
 				goto success;
 				
@@ -780,9 +789,10 @@ void HandleSetupPacket()
 					break;
 				if(wLength > 256)
 					break;
+				arena_claim(Arena_Service);
 					
-				flash_spiexchange(scratch_pad, wLength);
-				send_configdata(scratch_pad, wLength, wLength);
+				flash_spiexchange(arena.service.scratch_pad, wLength);
+				send_configdata(arena.service.scratch_pad, wLength, wLength);
 				return;
 				
 			case 0x1B: // FPGA raw SPI. Exchange wLength bytes with scratch pad, and return the resulting bytes.
@@ -790,9 +800,10 @@ void HandleSetupPacket()
 					break;
 				if(wLength > 256)
 					break;
+				arena_claim(Arena_Service);
 					
-				fpga_spiexchange(scratch_pad, wLength);
-				send_configdata(scratch_pad, wLength, wLength);
+				fpga_spiexchange(arena.service.scratch_pad, wLength);
+				send_configdata(arena.service.scratch_pad, wLength, wLength);
 				return;
 				
 			case 0x20: // Flash erase sector. Returns byte (0=failure, 1=success). Sector index in wValue (4096 byte sectors)
@@ -816,16 +827,18 @@ void HandleSetupPacket()
 					break;
 				if(wLength > 256)
 					break;
+				arena_claim(Arena_Service);
 				
-				flash_read(wValue * 256, wLength, scratch_pad);
-				send_configdata(scratch_pad, wLength, wLength);
+				flash_read(wValue * 256, wLength, arena.service.scratch_pad);
+				send_configdata(arena.service.scratch_pad, wLength, wLength);
 				return;
 				
 			case 0x23: // Flash program 256-byte block from scratch pad. Address/256 in wValue. Returns byte status.
 				if(bmRequestType != 0xC0) // Device to host.
 					break;
+				arena_claim(Arena_Service);
 				
-				flash_program(wValue * 256, 256, scratch_pad);
+				flash_program(wValue * 256, 256, arena.service.scratch_pad);
 				send_config1byte(flash_waitbusy(), wLength);
 				return;
 
@@ -846,6 +859,7 @@ void HandleSetupPacket()
 					   // Address/256 in wValue, reads 64k bytes and returns 4-byte Little Endian CRC32. (for quick validation)
 				if(bmRequestType != 0xC0) // Device to host.
 					break;  
+
 					
 				// todo
 					   
@@ -853,8 +867,262 @@ void HandleSetupPacket()
 			
 			
 			
-			// Todo: JTAG, not important for early bringup though. Reprogramming the flash is easy/fast enough.
-			
+			case 0x30: // Read/Write gamma. wValue = 0 for the curve (wLength 256), 1 for the R, G, B balance (wLength 3).
+				if(wValue > 1 || wLength != (wValue ? 3 : 256))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(wValue ? gamma_balance : gamma_curve, wLength, wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					gamma_identity = 0; // Table is in flux until the data has arrived.
+					incoming_data_location = wValue ? gamma_balance : gamma_curve;
+					incoming_data_length = wLength;
+					incoming_data_complete = gamma_update;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x31: // Gamma table control. wValue = 0 (restore defaults), 1 (load from flash), 2 (save to flash). Returns byte status.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				{
+					int result = 0;
+					switch(wValue)
+					{
+					case 0:
+						gamma_defaults();
+						result = 1;
+						break;
+					case 1:
+						if(flash_locked())
+							result = gamma_load();
+						break;
+					case 2:
+						if(flash_locked())
+							result = gamma_save();
+						break;
+					}
+					send_config1byte(result, wLength);
+				}
+				return;
+
+			case 0x32: // Read/Write panel layout (4 bytes: panel count, panels across, flags, rotation). Layout is validated once written.
+				if(wLength != sizeof(PanelLayout))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(&fb_layout, sizeof(PanelLayout), wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					incoming_data_location = (unsigned char*)&fb_layout;
+					incoming_data_length = sizeof(PanelLayout);
+					incoming_data_complete = fb_layout_update;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x33: // Animation playback. wValue = play mode (0 = stop, 1 = once, 2 = loop, 3 = ping-pong), wIndex = container address/64k. Returns byte status.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				if(wValue == PlayMode_Stop)
+				{
+					playback_stop();
+					send_config1byte(1, wLength);
+				}
+				else
+				{
+					send_config1byte(flash_locked() && playback_start(wIndex * Flash_BlockSize, wValue), wLength);
+				}
+				return;
+
+			case 0x34: // Animation playback status. Returns play mode byte, reserved byte, 16bit current frame.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				config_bytes[0] = play_mode;
+				config_bytes[1] = 0;
+				config_bytes[2] = play_frame & 0xFF;
+				config_bytes[3] = (play_frame >> 8) & 0xFF;
+				send_configdata(config_bytes, 4, wLength);
+				return;
+
+			case 0x36: // Read/Write ADC configuration (8 bytes, see AdcConfig). Written values are validated and applied immediately.
+				if(wLength != sizeof(AdcConfig))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(&adc_config, sizeof(AdcConfig), wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					incoming_data_location = (unsigned char*)&adc_pending;
+					incoming_data_length = sizeof(AdcConfig);
+					incoming_data_complete = adc_configure;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x37: // ADC interrupt load over the last 10ms tick. Returns 32bit cycles spent in the ISR, 16bit interrupt count, 16bit load in 1/10 percent.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+				{
+					int cycles = adc_load_cycles;
+					int load = cycles / (Adc_ClockHz / 100 / 1000); // Cycles per tick / 1000
+					config_bytes[0] = cycles & 0xFF;
+					config_bytes[1] = (cycles >> 8) & 0xFF;
+					config_bytes[2] = (cycles >> 16) & 0xFF;
+					config_bytes[3] = (cycles >> 24) & 0xFF;
+					config_bytes[4] = adc_load_calls & 0xFF;
+					config_bytes[5] = (adc_load_calls >> 8) & 0xFF;
+					config_bytes[6] = load & 0xFF;
+					config_bytes[7] = (load >> 8) & 0xFF;
+				}
+				send_configdata(config_bytes, 8, wLength);
+				return;
+
+			case 0x38: // Boot timing. Returns 32bit microsecond timestamps for each boot milestone (0xFFFFFFFF = not reached), then the current time.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+				{
+					unsigned long now = systime_us();
+					memcpy(config_bytes, boot_time, sizeof(boot_time));
+					memcpy(config_bytes + sizeof(boot_time), &now, 4);
+				}
+				send_configdata(config_bytes, sizeof(boot_time) + 4, wLength);
+				return;
+
+			case 0x3B: // USB bulk endpoint cost since the last read. Returns 32bit cycles spent in the bulk FIQ, 32bit FIQ calls, 32bit packets moved.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				usb_hold();
+				memcpy(config_bytes, &usb_bulk_cycles, 4);
+				memcpy(config_bytes + 4, &usb_bulk_calls, 4);
+				memcpy(config_bytes + 8, &usb_bulk_packets, 4);
+				usb_bulk_cycles = usb_bulk_calls = usb_bulk_packets = 0;
+				usb_release();
+				send_configdata(config_bytes, 12, wLength);
+				return;
+
+			case 0x3C: // Page flip. wValue = 1 (present the back page at the next frame), 0 (single buffering, display and draw page 0). Returns byte status.
+					   // Streamed drawing should use StreamCmd_Present instead, to stay in order with the stream.
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				if(wValue == 0)
+				{
+					fb_single_buffer();
+					send_config1byte(1, wLength);
+				}
+				else
+				{
+					send_config1byte(fb_present(), wLength);
+				}
+				return;
+
+			case 0x3D: // Read/Write scroll state (4 bytes: 16bit scroll column, signed 16bit auto-scroll pixels per 10ms tick in 8.8 fixed point).
+					   // Streamed drawing should use StreamCmd_Scroll to set the column, to stay in order with the stream.
+				if(wLength != sizeof(ScrollState))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(&fb_scroll, sizeof(ScrollState), wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					incoming_data_location = (unsigned char*)&fb_scroll_pending;
+					incoming_data_length = sizeof(ScrollState);
+					incoming_data_complete = fb_scroll_update;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x3E: // Frame queue status. wValue = 1 to clear the counters. Returns queued frames byte, most frames a frame was late by (byte),
+					   // 16bit current SOF frame number, 16bit frames shown late, 16bit frames that arrived early (queue full),
+					   // 16bit longest stream pass with the SOF masked (us).
+				if(bmRequestType != 0xC0) // Device to host.
+					break;
+
+				{
+					int frame = usb_frame;
+					config_bytes[0] = fb_queued;
+					config_bytes[1] = fb_late_max > 255 ? 255 : fb_late_max;
+					config_bytes[2] = frame & 0xFF;
+					config_bytes[3] = (frame >> 8) & 0xFF;
+					config_bytes[4] = fb_frames_late & 0xFF;
+					config_bytes[5] = (fb_frames_late >> 8) & 0xFF;
+					config_bytes[6] = fb_frames_early & 0xFF;
+					config_bytes[7] = (fb_frames_early >> 8) & 0xFF;
+					int masked = stream_masked_max > 0xFFFF ? 0xFFFF : stream_masked_max;
+					config_bytes[8] = masked & 0xFF;
+					config_bytes[9] = (masked >> 8) & 0xFF;
+				}
+				if(wValue == 1)
+				{
+					fb_frames_late = fb_frames_early = fb_late_max = 0;
+					stream_masked_max = 0;
+				}
+				send_configdata(config_bytes, 10, wLength);
+				return;
+
+			case 0x3F: // SOF clock. Read: 32bit clock (ms), 16bit SOF frame number, then since the last read: 16bit SOFs measured, 16bit max and 16bit mean jitter (us, FIQ timestamps).
+					   // Write (8 bytes): 32bit clock, 32bit frame number; the clock is set so it read that value at that SOF.
+				if(bmRequestType == 0xC0)
+				{
+					unsigned long clock = usb_clock;
+					int mean = usb_sof_count ? usb_sof_jitter_sum / usb_sof_count : 0;
+					memcpy(config_bytes, &clock, 4);
+					config_bytes[4] = usb_frame & 0xFF;
+					config_bytes[5] = (usb_frame >> 8) & 0xFF;
+					memcpy(config_bytes + 6, &usb_sof_count, 2);
+					memcpy(config_bytes + 8, &usb_sof_jitter_max, 2);
+					config_bytes[10] = mean & 0xFF;
+					config_bytes[11] = (mean >> 8) & 0xFF;
+					usb_sof_jitter_sum = usb_sof_jitter_max = usb_sof_count = 0;
+					send_configdata(config_bytes, 12, wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40 && wLength == 8)
+				{
+					// Lands in config_bytes, nothing is being sent back during this request.
+					incoming_data_location = config_bytes;
+					incoming_data_length = 8;
+					incoming_data_complete = usb_clock_set;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
+			case 0x42: // Read/Write display control (4 bytes: brightness, bit planes, scan rows, blank; see DisplayControl). Applied once written.
+				if(wLength != sizeof(DisplayControl))
+					break;
+
+				if(bmRequestType == 0xC0)
+				{
+					send_configdata(&fb_display, sizeof(DisplayControl), wLength);
+					return;
+				}
+				else if(bmRequestType == 0x40)
+				{
+					incoming_data_location = (unsigned char*)&fb_display;
+					incoming_data_length = sizeof(DisplayControl);
+					incoming_data_complete = fb_display_update;
+					return; // To be completed by the incoming data handler.
+				}
+				break;
+
 			case 0x41:
 			switch(wIndex)
 			{
@@ -871,7 +1139,7 @@ void HandleSetupPacket()
 				if(wValue == 0)
 				{
 					// Only respond for page 0 of interface 0
-					send_ext_prop(sizeof(ext_prop_names)/sizeof(*ext_prop_names), ext_prop_names, ext_prop_values, wLength);
+					send_configdata(os_ext_prop_descriptor, sizeof(os_ext_prop_descriptor), wLength);
 					return;
 				}
 				break;
@@ -884,23 +1152,28 @@ void HandleSetupPacket()
 		break;
 	}
 	// By default stall any unknown transactions.
+	usb_hold();
 	Usb_SetEndpointStatus(0,0x80);
+	usb_release();
 	return;
 success:
 	// Generic success: ACK return transaction.
+	usb_hold();
 	WritePacket(1,setupreq,0);
 	Usb_SelectEndpoint(1);
 	Usb_ValidateBuffer();
+	usb_release();
 }
 
 
 
 void usb_reset()
 {
-	InterruptDisable(INT_USBIRQ);
+	InterruptDisable(INT_USBIRQ); // The FIQ is either held or not enabled yet.
 
 	// Setup USB interrupts
 	USBDEVINTEN = 0x0397; // DEV_STAT, FRAME, EP0,1,3,6,7
+	USBDEVFIQSEL = 0x7; // FRAME, BULKOUT, BULKIN: the SOF and EP3 (6,7) go to the FIQ, everything else to the IRQ
 
 	Usb_SetDeviceStatus(0x0); // Disconnect
 	int i;
@@ -926,9 +1199,11 @@ void usb_reset()
 	config = 0;
 	configdata_start = 0; // Disable sending of config data);
 	incoming_data_location = 0;
+	incoming_data_complete = 0;
 	flash_lockout = 0;
 
 	Usb_SetDeviceStatus(1); // Connect!
+	boot_mark(Boot_UsbConnect);
 
 	InterruptEnable(INT_USBIRQ);
 }
@@ -936,79 +1211,60 @@ void usb_reset()
 
 
 // Handle serial streams
-#define USBSER_BUFFER 128
+#define USBSER_BUFFER 512 // Deep enough to keep pixel streaming going while the DPC is busy with the SPI bus
 
 FifoBuffer<USBSER_BUFFER> usbrx;
 FifoBuffer<512> usbtx;
 
 // Interrupt interface functions (write to rx buffer, read from tx buffer)
 
-unsigned char usbser_tempbuffer[64]; // Very sad to do it this way, wasting 64 bytes, but it makes the code so much simpler.
-// Considering wasting the 64 bytes on the stack, but it's wasted either way...
+unsigned long usbser_tempbuffer[16]; // One packet, word aligned for the packet buffer interface.
 
+// Endpoint 3 is double buffered. One select (which also clears the endpoint interrupt) reports both buffers,
+// and that many packets are moved without selecting again. Anything that changes afterwards raises a new interrupt.
 void usbser_tryrecv() // Endpoint 6 (3 OUT)
 {
-	int madeprogress = 0;
-	while(1)
+	int epstatus = Usb_SelectEndpointClearInterrupt(6);
+	int full = ((epstatus>>5)&1) + ((epstatus>>6)&1); // B_1_FULL, B_2_FULL
+	int received = 0;
+	while(received < full)
 	{
-		int epstatus = Usb_SelectEndpointClearInterrupt(6);
-		if(epstatus&1)
+		int length = ReadPacketLength(6);
+		if(length>64) length=64;
+		if(usbrx.Free() < length)
 		{
-			// There is a packet to receive!
-			int length = ReadPacketLength(6);
-			if(length>64) length=64;
-			// Can we get it?
-			int available = usbrx.Free();
-			if(available >= length)
-			{ // We have enough space!
-				ReadPacket(6,usbser_tempbuffer,length);
-				Usb_ClearBuffer();
-				int i;
-				for(i=0;i<length;i++)
-				{
-					usbrx.WriteByte(usbser_tempbuffer[i]);
-				}
-				madeprogress = 1;
-				continue; // Check for another packet
-			}
 			// We did not have enough space for the packet. 
 			// It will sit around until the next FRAME interrupt comes along and then check for more space.
+			USBCTRL = 0;
+			break;
 		}
-		// There was no packet. Stop looking for more data
-		break;
+		ReadPacketData(usbser_tempbuffer, length);
+		Usb_ClearBuffer();
+		usbrx.WriteBytes((unsigned char*)usbser_tempbuffer, length);
+		received++;
 	}
-	if(madeprogress) dpc_trigger();
+	usb_bulk_packets += received;
+	if(received) dpc_trigger();
 }
 void usbser_trysend() // Endpoint 7 (3 IN)
 {
-	int madeprogress = 0;
-	while(1)
+	int epstatus = Usb_SelectEndpointClearInterrupt(7);
+	int free = 2 - ((epstatus>>5)&1) - ((epstatus>>6)&1);
+	int sent = 0;
+	while(sent < free)
 	{
-		int epstatus = Usb_SelectEndpointClearInterrupt(7);
-		if((epstatus&1) == 0)
-		{
-			// We have space to send a packet! Is there anything to send?
-			int available = usbtx.Length();
-			if(available>64) available=64; // Can't send more than 64 bytes
-			if(available > 0)
-			{
-				// Some bytes exist, lets send them.
-				int i;
-				for(i=0;i<available;i++)
-				{
-					usbser_tempbuffer[i] = usbtx.ReadByte();
-				}
-				WritePacket(7,usbser_tempbuffer,available);
-				Usb_ValidateBuffer();
-				madeprogress = 1;
-				continue; // Try to send another packet, that was fun.
-			}
-			// We did not have any bytes to send
-		}
-		// There was not a buffer available to send bytes in. May or may not have had data to send, but it will wait until a new buffer arrives.
-		break;
+		int available = usbtx.Length();
+		if(available>64) available=64; // Can't send more than 64 bytes
+		if(available == 0)
+			break; // Nothing to send, a hint (or the next FRAME) brings us back.
+
+		usbtx.ReadBytes((unsigned char*)usbser_tempbuffer, available);
+		WritePacket(7,usbser_tempbuffer,available);
+		Usb_ValidateBuffer();
+		sent++;
 	}
-	if(madeprogress) dpc_trigger();
+	usb_bulk_packets += sent;
+	if(sent) dpc_trigger();
 }
 
 // Serial interface functions 
@@ -1093,25 +1349,47 @@ int Serial_SendQueued()
 
 void Serial_HintMoreData() // Suggest to USB chipset it should try exchanging data again. Should only call this if you have something worth sending or need it sent quickly (may lower bandwidth otherwise)
 {
-	// Inject a FRAME interrupt to the USB chipset.
-	USBDEVINTSET = 1; // Set FRAME interrupt
+	InterruptTrigger(INT_USBFIQ); // Run the bulk endpoint handler.
 }
 
 // Break out interrupt into smaller pieces
 
+// The SOF is routed to the FIQ only to be timestamped. The rest of its work uses the SPI bus, so it stays in the IRQ.
+void usbfiq_frame()
+{
+	USBDEVINTCLR = 0x0001;
+	usb_sof_time = systime_us();
+	usb_sof_frame = Usb_ReadFrameNumber16() & 0x7FF;
+	usb_sof_pending = 1;
+	InterruptTrigger(INT_USBIRQ);
+}
+
 void usbint_frame()
 {
-	// todo: something, anything here.
+	unsigned long now = usb_sof_time;
+	int frame = usb_sof_frame;
+	int elapsed = (frame - usb_frame) & 0x7FF; // More than 1 if SOFs were missed (or not seen while suspended)
+	usb_frame = frame;
+	usb_clock += elapsed;
 
-	usbser_tryrecv(); // Continue working if previously we jammed due to buffer space issues.
-	usbser_trysend();
+	if(usb_sof_count != 0xFFFF && elapsed > 0 && elapsed < 16)
+	{
+		int jitter = (int)(now - usb_sof_us) - elapsed * 1000;
+		if(jitter < 0) jitter = -jitter;
+		if(jitter > usb_sof_jitter_max) usb_sof_jitter_max = jitter;
+		usb_sof_jitter_sum += jitter;
+		usb_sof_count++;
+	}
+	usb_sof_us = now;
+
+	fb_sof(frame);
 }
 void usbint_ep0()
 { // Endpoint 0 OUT (into device)
 	led_busy(1);
 	// If we got a setup packet, we should handle it
 	int ep = Usb_SelectEndpointClearInterrupt(0);
-	if(ep&4) { HandleSetupPacket(); }
+	if(ep&4) { HandleSetupPacket(); usb_rehold(); } // Vendor requests drop the hold while they work.
 	else
 	{
 		if(ep&1) { 	
@@ -1123,7 +1401,7 @@ void usbint_ep0()
 				if(len > incoming_data_length)
 					len = incoming_data_length;
 					
-				ReadPacket(0, incoming_data_location, len);
+				ReadPacketData(incoming_data_location, len);
 				
 				incoming_data_location += len;
 				incoming_data_length -= len;
@@ -1131,6 +1409,9 @@ void usbint_ep0()
 				{
 					zlp = 1;
 					incoming_data_location = 0;
+					if(incoming_data_complete)
+						incoming_data_complete();
+					incoming_data_complete = 0;
 				}
 				
 			}
@@ -1163,22 +1444,13 @@ void usbint_ep3()
 { // Endpoint 1 IN (out from device)
 	// Interrupt endpoint, ignore. No need to send interrupts.
 }
-void usbint_ep6()
-{ // Endpoint 3 OUT (in to device)
-	// If we got data, and have space, read it!
-	usbser_tryrecv();
-}
-void usbint_ep7()
-{ // Endpoint 3 IN (out from device)
-	// Continue a send, if we have additional data to offload.
-	usbser_trysend();
-}
 
 void usbint_devstat()
 {
 	// Detect bus reset & change stuff appropriately.
 	int status = Usb_GetDeviceStatus();
 	// If not connected due to bus reset or connect change, re-setup the USB.
+	if(status&0x10) boot_mark(Boot_UsbReset);
 	if(status&0x12) usb_reset();
 }
 
@@ -1191,43 +1463,42 @@ extern "C" void int_USBIRQ();
 void int_USBIRQ()
 {
 	InterruptClear(INT_USBIRQ);
+	usb_hold();
 
-	if(USBDEVINTST&0x0001)
+	// Take all the pending sources at once. Bulk endpoints and the SOF are left alone, they belong to the FIQ.
+	unsigned long status = USBDEVINTST & 0x0216;
+	USBDEVINTCLR = status;
+
+	if(usb_sof_pending)
 	{
-		USBDEVINTCLR = 0x0001;
+		usb_sof_pending = 0;
 		usbint_frame();
 	}
-	if(USBDEVINTST&0x0002)
-	{
-		USBDEVINTCLR = 0x0002;
-		usbint_ep0();
-	}
-	if(USBDEVINTST&0x0004)
-	{
-		USBDEVINTCLR = 0x0004;
-		usbint_ep1();
-	}
-	if(USBDEVINTST&0x0010)
-	{
-		USBDEVINTCLR = 0x0010;
-		usbint_ep3();
-	}
-	if(USBDEVINTST&0x0080)
-	{
-		USBDEVINTCLR = 0x0080;
-		usbint_ep6();
-	}
-	if(USBDEVINTST&0x0100)
-	{
-		USBDEVINTCLR = 0x0100;
-		usbint_ep7();
-	}
-	if(USBDEVINTST&0x0200)
-	{
-		USBDEVINTCLR = 0x0200;
-		usbint_devstat();
-	}
-	// Done!
+	if(status&0x0002) usbint_ep0();
+	if(status&0x0004) usbint_ep1();
+	if(status&0x0010) usbint_ep3();
+	if(status&0x0200) usbint_devstat();
+
+	usb_release();
+}
+
+// Bulk endpoint interrupt, EP3 OUT/IN and the SOF are routed here (USBDEVFIQSEL). Also triggered in software to retry.
+extern "C" void int_USBFIQ();
+void int_USBFIQ()
+{
+	int start = TMR32B1TC;
+
+	InterruptClear(INT_USBFIQ);
+	if(USBDEVINTST & 0x0001)
+		usbfiq_frame(); // Also continues the bulk endpoints every frame, in case we previously jammed due to buffer space issues.
+	USBDEVINTCLR = 0x0180;
+	usbser_tryrecv();
+	usbser_trysend();
+
+	int cycles = TMR32B1TC - start;
+	if(cycles < 0) cycles += TMR32B1MR0 + 1; // The tick timer wrapped
+	usb_bulk_cycles += cycles + Usb_FiqOverhead;
+	usb_bulk_calls++;
 }
 
 
@@ -1241,9 +1512,21 @@ void usb_init()
 	usbtx.init();
 
 	InterruptSetPriority(INT_USBIRQ, 8); // Give slightly lower priority than the clock interrupt.
+	InterruptSetPriority(INT_USBFIQ, 4); // Bulk data ahead of control requests, still behind the ADC.
 
 	// Initialize USB chipset
+	InterruptDisable(INT_USBFIQ);
+	InterruptClear(INT_USBFIQ);
+	usb_holdcount = 0;
+	usb_bulk_cycles = usb_bulk_calls = usb_bulk_packets = 0;
+	usb_frame = 0;
+	usb_clock = 0;
+	usb_sof_time = usb_sof_us = 0;
+	usb_sof_frame = usb_sof_pending = 0;
+	usb_sof_jitter_sum = usb_sof_jitter_max = usb_sof_count = 0;
+	usb_build_serial(); // ReadDeviceUID has run by now
 	usb_reset();
+	InterruptEnable(INT_USBFIQ);
 }
 
 
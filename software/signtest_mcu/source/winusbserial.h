@@ -26,6 +26,12 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 // Public USB routines
 void usb_init();
 int usb_IsActive();
+extern volatile int usb_frame; // Frame number (11 bits) of the last USB SOF
+
+// SOF clock: the frame number extended into a monotonic 1ms clock. All devices on one host controller see the same SOFs,
+// so setting the same epoch on each of them gives them a common timeline.
+extern volatile unsigned long usb_clock; // ms, as of the last SOF
+void usb_clock_epoch(unsigned long clock, int frame); // The clock reads 'clock' at SOF 'frame' (within the last 2 seconds)
 
 
 // Serial port related routines